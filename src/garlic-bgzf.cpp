@@ -0,0 +1,288 @@
+#include "garlic-bgzf.h"
+#include "garlic-errlog.h"
+#include <iostream>
+#include <cstring>
+#include <zlib.h>
+
+using namespace std;
+
+static int BGZF_THREADS = 1;
+
+void setBGZFThreads(int numThreads)
+{
+    BGZF_THREADS = numThreads;
+}
+
+int getBGZFThreads()
+{
+    return BGZF_THREADS;
+}
+
+//A BGZF block is a gzip member with FEXTRA set and a 'BC' subfield
+//holding the total block size minus one
+static int findBlockSize(const unsigned char *header, int xlen)
+{
+    int p = 12;
+    while (p + 4 <= 12 + xlen)
+    {
+        int slen = header[p + 2] | (header[p + 3] << 8);
+        if (header[p] == 'B' && header[p + 1] == 'C' && slen == 2 && p + 6 <= 12 + xlen)
+        {
+            return (header[p + 4] | (header[p + 5] << 8)) + 1;
+        }
+        p += 4 + slen;
+    }
+    return -1;
+}
+
+bool isBGZF(const char *filename)
+{
+    if (strcmp(filename, "-") == 0) return false;
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) return false;
+    unsigned char header[18];
+    int n = fread(header, 1, 18, fp);
+    fclose(fp);
+    if (n < 18) return false;
+    if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 4)) return false;
+    int xlen = header[10] | (header[11] << 8);
+    return (xlen >= 6 && header[12] == 'B' && header[13] == 'C');
+}
+
+//Returns 1 if a block was read, 0 at a clean end of file, -1 otherwise
+static int readRawBlock(FILE *fp, bgzf_slot_t *slot)
+{
+    unsigned char *cdata = slot->cdata;
+    int n = fread(cdata, 1, 12, fp);
+    if (n == 0) return 0;
+    if (n < 12) return -1;
+    if (cdata[0] != 0x1f || cdata[1] != 0x8b || cdata[2] != 8 || !(cdata[3] & 4)) return -1;
+    int xlen = cdata[10] | (cdata[11] << 8);
+    if (12 + xlen > BGZF_MAX_BLOCK_SIZE) return -1;
+    if ((int)fread(cdata + 12, 1, xlen, fp) != xlen) return -1;
+    int bsize = findBlockSize(cdata, xlen);
+    if (bsize < 12 + xlen + 8) return -1;
+    int remaining = bsize - 12 - xlen;
+    if ((int)fread(cdata + 12 + xlen, 1, remaining, fp) != remaining) return -1;
+    slot->csize = bsize;
+    return 1;
+}
+
+static bool inflateBlock(z_stream *zs, bgzf_slot_t *slot)
+{
+    unsigned char *cdata = slot->cdata;
+    int xlen = cdata[10] | (cdata[11] << 8);
+    unsigned char *trailer = cdata + slot->csize - 8;
+    unsigned long crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned long)trailer[3] << 24);
+    int isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | (trailer[7] << 24);
+    if (isize < 0 || isize > BGZF_MAX_BLOCK_SIZE) return false;
+
+    if (inflateReset(zs) != Z_OK) return false;
+    zs->next_in = cdata + 12 + xlen;
+    zs->avail_in = slot->csize - 12 - xlen - 8;
+    zs->next_out = (Bytef *)slot->udata;
+    zs->avail_out = BGZF_MAX_BLOCK_SIZE;
+    if (inflate(zs, Z_FINISH) != Z_STREAM_END) return false;
+
+    slot->usize = zs->total_out;
+    if (slot->usize != isize) return false;
+    if (crc32(crc32(0L, Z_NULL, 0), (Bytef *)slot->udata, slot->usize) != crc) return false;
+    return true;
+}
+
+static void *readerThread(void *arg)
+{
+    BGZFReader *bgzf = (BGZFReader *)arg;
+    while (true)
+    {
+        pthread_mutex_lock(&(bgzf->mutex));
+        while (!bgzf->stop && bgzf->nextRead - bgzf->nextConsume >= bgzf->numSlots)
+        {
+            pthread_cond_wait(&(bgzf->canRead), &(bgzf->mutex));
+        }
+        if (bgzf->stop)
+        {
+            pthread_mutex_unlock(&(bgzf->mutex));
+            break;
+        }
+        bgzf_slot_t *slot = &(bgzf->slots[bgzf->nextRead % bgzf->numSlots]);
+        pthread_mutex_unlock(&(bgzf->mutex));
+
+        //The slot is free until nextRead is advanced, so no lock is held
+        //during the disk read
+        int status = readRawBlock(bgzf->fp, slot);
+
+        pthread_mutex_lock(&(bgzf->mutex));
+        if (status <= 0)
+        {
+            bgzf->readDone = true;
+            bgzf->readError = (status < 0);
+            pthread_cond_broadcast(&(bgzf->canInflate));
+            pthread_cond_broadcast(&(bgzf->canConsume));
+            pthread_mutex_unlock(&(bgzf->mutex));
+            break;
+        }
+        slot->state = BGZF_SLOT_READ;
+        bgzf->nextRead++;
+        pthread_cond_signal(&(bgzf->canInflate));
+        pthread_mutex_unlock(&(bgzf->mutex));
+    }
+    return NULL;
+}
+
+static void *inflateThread(void *arg)
+{
+    BGZFReader *bgzf = (BGZFReader *)arg;
+    z_stream zs;
+    memset(&zs, 0, sizeof(z_stream));
+    bool zok = (inflateInit2(&zs, -15) == Z_OK);
+    while (true)
+    {
+        pthread_mutex_lock(&(bgzf->mutex));
+        while (!bgzf->stop && bgzf->nextInflate == bgzf->nextRead && !bgzf->readDone)
+        {
+            pthread_cond_wait(&(bgzf->canInflate), &(bgzf->mutex));
+        }
+        if (bgzf->stop || bgzf->nextInflate == bgzf->nextRead)
+        {
+            pthread_mutex_unlock(&(bgzf->mutex));
+            break;
+        }
+        bgzf_slot_t *slot = &(bgzf->slots[bgzf->nextInflate % bgzf->numSlots]);
+        bgzf->nextInflate++;
+        pthread_mutex_unlock(&(bgzf->mutex));
+
+        bool ok = zok && inflateBlock(&zs, slot);
+
+        pthread_mutex_lock(&(bgzf->mutex));
+        slot->state = ok ? BGZF_SLOT_INFLATED : BGZF_SLOT_ERROR;
+        pthread_cond_broadcast(&(bgzf->canConsume));
+        pthread_mutex_unlock(&(bgzf->mutex));
+    }
+    if (zok) inflateEnd(&zs);
+    return NULL;
+}
+
+BGZFReader *openBGZF(const char *filename, int numThreads)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) return NULL;
+
+    BGZFReader *bgzf = new BGZFReader;
+    bgzf->fp = fp;
+    bgzf->numThreads = (numThreads < 1) ? 1 : numThreads;
+    bgzf->numSlots = 4 * bgzf->numThreads;
+    bgzf->slots = new bgzf_slot_t[bgzf->numSlots];
+    for (int i = 0; i < bgzf->numSlots; i++)
+    {
+        bgzf->slots[i].cdata = new unsigned char[BGZF_MAX_BLOCK_SIZE];
+        bgzf->slots[i].udata = new char[BGZF_MAX_BLOCK_SIZE];
+        bgzf->slots[i].csize = 0;
+        bgzf->slots[i].usize = 0;
+        bgzf->slots[i].state = BGZF_SLOT_READ;
+    }
+    bgzf->nextRead = 0;
+    bgzf->nextInflate = 0;
+    bgzf->nextConsume = 0;
+    bgzf->holding = false;
+    bgzf->readDone = false;
+    bgzf->readError = false;
+    bgzf->stop = false;
+
+    pthread_mutex_init(&(bgzf->mutex), NULL);
+    pthread_cond_init(&(bgzf->canRead), NULL);
+    pthread_cond_init(&(bgzf->canInflate), NULL);
+    pthread_cond_init(&(bgzf->canConsume), NULL);
+
+    pthread_create(&(bgzf->reader), NULL, readerThread, (void *)bgzf);
+    bgzf->workers = new pthread_t[bgzf->numThreads];
+    for (int i = 0; i < bgzf->numThreads; i++)
+    {
+        pthread_create(&(bgzf->workers[i]), NULL, inflateThread, (void *)bgzf);
+    }
+
+    return bgzf;
+}
+
+int readBGZFBlock(BGZFReader *bgzf, char **data)
+{
+    pthread_mutex_lock(&(bgzf->mutex));
+    while (true)
+    {
+        //Give the previously returned slot back to the reader
+        if (bgzf->holding)
+        {
+            bgzf->nextConsume++;
+            bgzf->holding = false;
+            pthread_cond_signal(&(bgzf->canRead));
+        }
+
+        bgzf_slot_t *slot = &(bgzf->slots[bgzf->nextConsume % bgzf->numSlots]);
+        while ((bgzf->nextConsume == bgzf->nextRead && !bgzf->readDone) ||
+                (bgzf->nextConsume < bgzf->nextRead && slot->state == BGZF_SLOT_READ))
+        {
+            pthread_cond_wait(&(bgzf->canConsume), &(bgzf->mutex));
+        }
+
+        if (bgzf->nextConsume == bgzf->nextRead)
+        {
+            bool error = bgzf->readError;
+            pthread_mutex_unlock(&(bgzf->mutex));
+            if (error)
+            {
+                LOG.err("ERROR: Truncated or malformed BGZF block.");
+                return -1;
+            }
+            return 0;
+        }
+
+        if (slot->state == BGZF_SLOT_ERROR)
+        {
+            pthread_mutex_unlock(&(bgzf->mutex));
+            LOG.err("ERROR: Failed to decompress BGZF block.");
+            return -1;
+        }
+
+        bgzf->holding = true;
+        //Empty blocks (e.g. the EOF marker) are skipped
+        if (slot->usize > 0)
+        {
+            *data = slot->udata;
+            pthread_mutex_unlock(&(bgzf->mutex));
+            return slot->usize;
+        }
+    }
+}
+
+void closeBGZF(BGZFReader *bgzf)
+{
+    if (bgzf == NULL) return;
+
+    pthread_mutex_lock(&(bgzf->mutex));
+    bgzf->stop = true;
+    pthread_cond_broadcast(&(bgzf->canRead));
+    pthread_cond_broadcast(&(bgzf->canInflate));
+    pthread_mutex_unlock(&(bgzf->mutex));
+
+    pthread_join(bgzf->reader, NULL);
+    for (int i = 0; i < bgzf->numThreads; i++)
+    {
+        pthread_join(bgzf->workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&(bgzf->mutex));
+    pthread_cond_destroy(&(bgzf->canRead));
+    pthread_cond_destroy(&(bgzf->canInflate));
+    pthread_cond_destroy(&(bgzf->canConsume));
+
+    for (int i = 0; i < bgzf->numSlots; i++)
+    {
+        delete [] bgzf->slots[i].cdata;
+        delete [] bgzf->slots[i].udata;
+    }
+    delete [] bgzf->slots;
+    delete [] bgzf->workers;
+    fclose(bgzf->fp);
+    delete bgzf;
+    return;
+}
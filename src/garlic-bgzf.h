@@ -0,0 +1,70 @@
+#ifndef __GARLIC_BGZF_H__
+#define __GARLIC_BGZF_H__
+
+#include <cstdio>
+#include <pthread.h>
+
+//BGZF blocks never exceed 64KB compressed or uncompressed
+const int BGZF_MAX_BLOCK_SIZE = 65536;
+
+//Slot states in the block ring
+const int BGZF_SLOT_READ = 0;
+const int BGZF_SLOT_INFLATED = 1;
+const int BGZF_SLOT_ERROR = 2;
+
+struct bgzf_slot_t
+{
+    unsigned char *cdata;
+    int csize;
+    char *udata;
+    int usize;
+    int state;
+};
+
+//A reader thread pulls compressed blocks off disk into a ring of slots,
+//worker threads inflate them out of order, and the consumer takes them
+//back in file order.
+struct BGZFReader
+{
+    FILE *fp;
+    int numThreads;
+    pthread_t reader;
+    pthread_t *workers;
+
+    bgzf_slot_t *slots;
+    int numSlots;
+
+    //Sequence numbers of blocks read from disk, claimed by an
+    //inflate worker, and handed to the consumer
+    long nextRead;
+    long nextInflate;
+    long nextConsume;
+    bool holding;
+
+    bool readDone;
+    bool readError;
+    bool stop;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t canRead;
+    pthread_cond_t canInflate;
+    pthread_cond_t canConsume;
+};
+
+//Number of inflate workers used for BGZF input.  With 1 (the default)
+//BGZF files are read through the regular gzip path.
+void setBGZFThreads(int numThreads);
+int getBGZFThreads();
+
+bool isBGZF(const char *filename);
+
+BGZFReader *openBGZF(const char *filename, int numThreads);
+
+//Points data at the next decompressed block in file order and returns
+//its size.  Returns 0 at end of file and -1 on a corrupt block.  The
+//data remain valid until the next call.
+int readBGZFBlock(BGZFReader *bgzf, char **data);
+
+void closeBGZF(BGZFReader *bgzf);
+
+#endif
@@ -0,0 +1,893 @@
+#include "garlic-cache.h"
+#include <cstdio>
+#include <climits>
+
+const char GENO_CACHE_MAGIC[8] = {'G', 'A', 'R', 'L', 'G', 'E', 'N', '\0'};
+const char STAGE_CACHE_MAGIC[8] = {'G', 'A', 'R', 'L', 'S', 'T', 'G', '\0'};
+
+//Eight bytes at a time, with any tail folded in bytewise
+uint64_t cacheChecksum(const char *p, size_t n, uint64_t h)
+{
+    size_t nwords = n / 8;
+    for (size_t i = 0; i < nwords; i++)
+    {
+        uint64_t w;
+        memcpy(&w, p + 8 * i, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 32;
+    }
+    for (size_t i = nwords * 8; i < n; i++)
+    {
+        h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+#ifndef _WIN32
+
+static bool describeCacheSource(string filename, cache_source_t &source)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL) return false;
+
+    source.size = st.st_size;
+    source.mtime = st.st_mtime;
+
+    vector< char > buf(CACHE_SAMPLE_BYTES);
+    uint64_t h = cacheChecksum((const char *)&(source.size), sizeof(source.size), CACHE_HASH_SEED);
+    size_t n = fread(&(buf[0]), 1, CACHE_SAMPLE_BYTES, fp);
+    h = cacheChecksum(&(buf[0]), n, h);
+    if ((size_t)st.st_size > CACHE_SAMPLE_BYTES && fseeko(fp, st.st_size - CACHE_SAMPLE_BYTES, SEEK_SET) == 0)
+    {
+        n = fread(&(buf[0]), 1, CACHE_SAMPLE_BYTES, fp);
+        h = cacheChecksum(&(buf[0]), n, h);
+    }
+    fclose(fp);
+
+    source.sample = h;
+    return true;
+}
+
+//The cache file is named for the inputs, so different cohorts can share
+//a directory
+static string genotypeCacheFile(string cacheDir, const vector< string > &sourceFiles, char TPED_MISSING)
+{
+    string key(1, TPED_MISSING);
+    for (unsigned int i = 0; i < sourceFiles.size(); i++)
+    {
+        char *fullPath = realpath(sourceFiles[i].c_str(), NULL);
+        key += '\0';
+        key += (fullPath != NULL) ? string(fullPath) : sourceFiles[i];
+        free(fullPath);
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "genotypes-%016llx.cache",
+             (unsigned long long)cacheChecksum(key.data(), key.size(), CACHE_HASH_SEED));
+    return cacheDir + "/" + name;
+}
+
+string cacheTmpFile(string cacheFile)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".tmp.%d", (int)getpid());
+    return cacheFile + suffix;
+}
+
+static uint64_t alignCacheOffset(uint64_t offset)
+{
+    return (offset + GENO_CACHE_ALIGN - 1) / GENO_CACHE_ALIGN * GENO_CACHE_ALIGN;
+}
+
+static void putBytes(string &buf, const void *p, size_t n)
+{
+    buf.append((const char *)p, n);
+}
+
+static void putInt32(string &buf, int32_t val)
+{
+    putBytes(buf, &val, sizeof(val));
+}
+
+static void putUInt64(string &buf, uint64_t val)
+{
+    putBytes(buf, &val, sizeof(val));
+}
+
+static void putDouble(string &buf, double val)
+{
+    putBytes(buf, &val, sizeof(val));
+}
+
+static void putString(string &buf, const string &str)
+{
+    putInt32(buf, str.size());
+    buf += str;
+}
+
+//Reads fail soft; once past the end every read returns zeros and ok is
+//cleared
+struct cache_cursor_t
+{
+    const char *p;
+    const char *end;
+    bool ok;
+};
+
+static const char *getBytes(cache_cursor_t &cur, size_t n)
+{
+    if (!cur.ok || (size_t)(cur.end - cur.p) < n)
+    {
+        cur.ok = false;
+        return NULL;
+    }
+    const char *q = cur.p;
+    cur.p += n;
+    return q;
+}
+
+static int32_t getInt32(cache_cursor_t &cur)
+{
+    int32_t val = 0;
+    const char *q = getBytes(cur, sizeof(val));
+    if (q != NULL) memcpy(&val, q, sizeof(val));
+    return val;
+}
+
+static uint64_t getUInt64(cache_cursor_t &cur)
+{
+    uint64_t val = 0;
+    const char *q = getBytes(cur, sizeof(val));
+    if (q != NULL) memcpy(&val, q, sizeof(val));
+    return val;
+}
+
+static double getDouble(cache_cursor_t &cur)
+{
+    double val = 0;
+    const char *q = getBytes(cur, sizeof(val));
+    if (q != NULL) memcpy(&val, q, sizeof(val));
+    return val;
+}
+
+static string getString(cache_cursor_t &cur)
+{
+    uint32_t len = getInt32(cur);
+    const char *q = getBytes(cur, len);
+    return (q != NULL) ? string(q, len) : string();
+}
+
+static void releaseCacheData(IndData *indData,
+                             vector< MapData * > *mapDataByChr,
+                             vector< HapData * > *hapDataByChr)
+{
+    if (indData != NULL) releaseIndData(indData);
+    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++) releaseMapData(mapDataByChr->at(chr));
+    for (unsigned int chr = 0; chr < hapDataByChr->size(); chr++) releaseHapData(hapDataByChr->at(chr));
+    delete mapDataByChr;
+    delete hapDataByChr;
+    return;
+}
+
+bool readGenotypeCache(string cacheDir, const vector< string > &sourceFiles, char TPED_MISSING,
+                       IndData **indData,
+                       vector< MapData * > **mapDataByChr,
+                       vector< HapData * > **hapDataByChr,
+                       vector< int_pair_t > **chrCoordList,
+                       int &numLoci)
+{
+    if (sourceFiles.size() > (unsigned int)GENO_CACHE_MAX_SOURCES) return false;
+    cache_source_t source[GENO_CACHE_MAX_SOURCES];
+    for (unsigned int i = 0; i < sourceFiles.size(); i++)
+    {
+        if (!describeCacheSource(sourceFiles[i], source[i]))
+        {
+            LOG.err("WARNING: Only regular files can be cached, not caching", sourceFiles[i]);
+            return false;
+        }
+    }
+
+    string cacheFile = genotypeCacheFile(cacheDir, sourceFiles, TPED_MISSING);
+    int fd = open(cacheFile.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(geno_cache_header_t))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    const char *base = (const char *)addr;
+
+    geno_cache_header_t header;
+    memcpy(&header, base, sizeof(header));
+    bool ok = memcmp(header.magic, GENO_CACHE_MAGIC, 8) == 0 &&
+              header.version == GENO_CACHE_VERSION &&
+              header.nsource == sourceFiles.size() &&
+              header.TPED_MISSING == TPED_MISSING &&
+              header.fileSize == size &&
+              header.metaSize <= size - sizeof(header);
+    for (unsigned int i = 0; ok && i < sourceFiles.size(); i++)
+    {
+        ok = header.source[i].size == source[i].size &&
+             header.source[i].mtime == source[i].mtime &&
+             header.source[i].sample == source[i].sample;
+    }
+    ok = ok && cacheChecksum(base + sizeof(header), header.metaSize, CACHE_HASH_SEED) == header.metaChecksum;
+    if (!ok)
+    {
+        munmap(addr, size);
+        close(fd);
+        LOG.log("Genotype cache is stale, rebuilding:", cacheFile);
+        return false;
+    }
+
+    cout << "Loading map and genotypes from cache " << cacheFile << "\n";
+
+    cache_cursor_t cur;
+    cur.p = base + sizeof(header);
+    cur.end = cur.p + header.metaSize;
+    cur.ok = true;
+
+    IndData *newIndData = NULL;
+    vector< MapData * > *newMapDataByChr = new vector< MapData * >;
+    vector< HapData * > *newHapDataByChr = new vector< HapData * >;
+    vector< uint64_t > offset;
+
+    string pop = getString(cur);
+    int nind = getInt32(cur);
+    if (cur.ok && nind > 0)
+    {
+        newIndData = initIndData(nind);
+        newIndData->pop = pop;
+        for (int ind = 0; ind < nind; ind++) newIndData->indID[ind] = getString(cur);
+    }
+    else cur.ok = false;
+
+    int nchr = getInt32(cur);
+    int wordsPerLocus = hapWordsPerLocus(nind);
+    uint64_t genoEnd = sizeof(header) + header.metaSize;
+    for (int chr = 0; cur.ok && chr < nchr; chr++)
+    {
+        string chrName = getString(cur);
+        int nloci = getInt32(cur);
+        uint64_t genoOffset = getUInt64(cur);
+        bool hasCounts = getInt32(cur) != 0;
+        size_t genoBytes = (size_t)nloci * wordsPerLocus * sizeof(uint64_t);
+        if (!cur.ok || nloci <= 0 || genoOffset % GENO_CACHE_ALIGN != 0 || genoOffset < genoEnd ||
+                genoOffset > size || genoBytes > size - genoOffset)
+        {
+            cur.ok = false;
+            break;
+        }
+
+        const char *physicalPos = getBytes(cur, (size_t)nloci * sizeof(int32_t));
+        const char *geneticPos = getBytes(cur, (size_t)nloci * sizeof(double));
+        const char *allele = getBytes(cur, nloci);
+        if (!cur.ok) break;
+
+        MapData *mapData = initMapData(nloci);
+        newMapDataByChr->push_back(mapData);
+        mapData->chr = chrName;
+        memcpy(mapData->physicalPos, physicalPos, (size_t)nloci * sizeof(int32_t));
+        memcpy(mapData->geneticPos, geneticPos, (size_t)nloci * sizeof(double));
+        memcpy(mapData->allele, allele, nloci);
+        for (int locus = 0; locus < nloci; locus++) mapData->locusName[locus] = getString(cur);
+
+        const char *alleleCount = NULL;
+        const char *calledCount = NULL;
+        if (hasCounts)
+        {
+            alleleCount = getBytes(cur, (size_t)nloci * sizeof(int32_t));
+            calledCount = getBytes(cur, (size_t)nloci * sizeof(int32_t));
+        }
+        if (!cur.ok) break;
+
+        genoEnd = genoOffset + genoBytes;
+        offset.push_back(genoOffset);
+
+        HapData *hapData = new HapData;
+        hapData->nind = nind;
+        hapData->nloci = nloci;
+        hapData->wordsPerLocus = wordsPerLocus;
+        hapData->data = NULL;
+        hapData->mappedBytes = 0;
+        hapData->alleleCount = NULL;
+        hapData->calledCount = NULL;
+        newHapDataByChr->push_back(hapData);
+        if (hasCounts)
+        {
+            initHapCounts(hapData);
+            memcpy(hapData->alleleCount, alleleCount, (size_t)nloci * sizeof(int32_t));
+            memcpy(hapData->calledCount, calledCount, (size_t)nloci * sizeof(int32_t));
+        }
+    }
+    ok = cur.ok && nchr > 0 && newHapDataByChr->size() == (unsigned int)nchr && genoEnd == size;
+
+    //Each chromosome gets its own copy on write mapping, released along
+    //with its HapData
+    for (int chr = 0; ok && chr < nchr; chr++)
+    {
+        HapData *hapData = newHapDataByChr->at(chr);
+        size_t genoBytes = (size_t)hapData->nloci * wordsPerLocus * sizeof(uint64_t);
+        void *geno = mmap(NULL, genoBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset[chr]);
+        if (geno == MAP_FAILED)
+        {
+            ok = false;
+            break;
+        }
+        hapData->data = (uint64_t *)geno;
+        hapData->mappedBytes = genoBytes;
+    }
+
+    munmap(addr, size);
+    close(fd);
+
+    if (!ok)
+    {
+        releaseCacheData(newIndData, newMapDataByChr, newHapDataByChr);
+        LOG.err("WARNING: Genotype cache is damaged, rebuilding:", cacheFile);
+        return false;
+    }
+
+    vector< int_pair_t > *chrStartStop = new vector< int_pair_t >;
+    numLoci = 0;
+    for (int chr = 0; chr < nchr; chr++)
+    {
+        int_pair_t coord;
+        coord.first = numLoci;
+        numLoci += newMapDataByChr->at(chr)->nloci;
+        coord.second = numLoci - 1;
+        chrStartStop->push_back(coord);
+    }
+
+    *indData = newIndData;
+    *mapDataByChr = newMapDataByChr;
+    *hapDataByChr = newHapDataByChr;
+    *chrCoordList = chrStartStop;
+    return true;
+}
+
+void writeGenotypeCache(string cacheDir, const vector< string > &sourceFiles, char TPED_MISSING,
+                        IndData *indData,
+                        vector< MapData * > *mapDataByChr,
+                        vector< HapData * > *hapDataByChr)
+{
+    if (sourceFiles.size() > (unsigned int)GENO_CACHE_MAX_SOURCES) return;
+
+    geno_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GENO_CACHE_MAGIC, 8);
+    header.version = GENO_CACHE_VERSION;
+    header.nsource = sourceFiles.size();
+    header.TPED_MISSING = TPED_MISSING;
+    for (unsigned int i = 0; i < sourceFiles.size(); i++)
+    {
+        if (!describeCacheSource(sourceFiles[i], header.source[i])) return;
+    }
+
+    string meta;
+    putString(meta, indData->pop);
+    putInt32(meta, indData->nind);
+    for (int ind = 0; ind < indData->nind; ind++) putString(meta, indData->indID[ind]);
+
+    int nchr = mapDataByChr->size();
+    putInt32(meta, nchr);
+    vector< size_t > offsetAt;
+    vector< size_t > genoBytes;
+    for (int chr = 0; chr < nchr; chr++)
+    {
+        MapData *mapData = mapDataByChr->at(chr);
+        HapData *hapData = hapDataByChr->at(chr);
+        int nloci = mapData->nloci;
+        bool hasCounts = (hapData->alleleCount != NULL && hapData->calledCount != NULL);
+
+        putString(meta, mapData->chr);
+        putInt32(meta, nloci);
+        offsetAt.push_back(meta.size());
+        putUInt64(meta, 0);
+        putInt32(meta, hasCounts);
+        putBytes(meta, mapData->physicalPos, (size_t)nloci * sizeof(int32_t));
+        putBytes(meta, mapData->geneticPos, (size_t)nloci * sizeof(double));
+        putBytes(meta, mapData->allele, nloci);
+        for (int locus = 0; locus < nloci; locus++) putString(meta, mapData->locusName[locus]);
+        if (hasCounts)
+        {
+            putBytes(meta, hapData->alleleCount, (size_t)nloci * sizeof(int32_t));
+            putBytes(meta, hapData->calledCount, (size_t)nloci * sizeof(int32_t));
+        }
+        genoBytes.push_back((size_t)nloci * hapData->wordsPerLocus * sizeof(uint64_t));
+    }
+
+    vector< uint64_t > offset;
+    uint64_t nextOffset = alignCacheOffset(sizeof(header) + meta.size());
+    for (int chr = 0; chr < nchr; chr++)
+    {
+        offset.push_back(nextOffset);
+        memcpy(&(meta[offsetAt[chr]]), &nextOffset, sizeof(nextOffset));
+        nextOffset = alignCacheOffset(nextOffset + genoBytes[chr]);
+    }
+    header.metaSize = meta.size();
+    header.metaChecksum = cacheChecksum(meta.data(), meta.size(), CACHE_HASH_SEED);
+    header.fileSize = (nchr > 0) ? offset.back() + genoBytes.back() : sizeof(header) + meta.size();
+
+    mkdir(cacheDir.c_str(), 0755);
+    string cacheFile = genotypeCacheFile(cacheDir, sourceFiles, TPED_MISSING);
+    string tmpFile = cacheTmpFile(cacheFile);
+
+    FILE *fp = fopen(tmpFile.c_str(), "wb");
+    if (fp == NULL)
+    {
+        LOG.err("WARNING: Could not write genotype cache", cacheFile);
+        return;
+    }
+
+    cout << "Writing genotype cache " << cacheFile << "\n";
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(meta.data(), 1, meta.size(), fp) == meta.size();
+    uint64_t written = sizeof(header) + meta.size();
+    vector< char > zeros(GENO_CACHE_ALIGN, 0);
+    for (int chr = 0; ok && chr < nchr; chr++)
+    {
+        ok = fwrite(&(zeros[0]), 1, offset[chr] - written, fp) == offset[chr] - written &&
+             fwrite(hapDataByChr->at(chr)->data, 1, genoBytes[chr], fp) == genoBytes[chr];
+        written = offset[chr] + genoBytes[chr];
+    }
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmpFile.c_str(), cacheFile.c_str()) != 0)
+    {
+        unlink(tmpFile.c_str());
+        LOG.err("WARNING: Could not write genotype cache", cacheFile);
+    }
+    return;
+}
+
+string cacheInputKey(const vector< string > &sourceFiles)
+{
+    string key;
+    for (unsigned int i = 0; i < sourceFiles.size(); i++)
+    {
+        cache_source_t source;
+        if (!describeCacheSource(sourceFiles[i], source)) return "";
+        char *fullPath = realpath(sourceFiles[i].c_str(), NULL);
+        char desc[96];
+        snprintf(desc, sizeof(desc), " %lld %lld %016llx;", (long long)source.size,
+                 (long long)source.mtime, (unsigned long long)source.sample);
+        key += (fullPath != NULL) ? string(fullPath) : sourceFiles[i];
+        key += desc;
+        free(fullPath);
+    }
+    return key;
+}
+
+static string stageCacheFile(string cacheDir, string stage, const string &key)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "-%016llx.cache",
+             (unsigned long long)cacheChecksum(key.data(), key.size(), CACHE_HASH_SEED));
+    return cacheDir + "/" + stage + name;
+}
+
+static void initStageHeader(stage_cache_header_t &header, const string &key, uint64_t dataSize)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STAGE_CACHE_MAGIC, 8);
+    header.version = STAGE_CACHE_VERSION;
+    header.keySize = key.size();
+    header.dataSize = dataSize;
+    return;
+}
+
+static bool checkStageHeader(const stage_cache_header_t &header, const string &key, uint64_t fileSize)
+{
+    return memcmp(header.magic, STAGE_CACHE_MAGIC, 8) == 0 &&
+           header.version == STAGE_CACHE_VERSION &&
+           header.keySize == key.size() &&
+           sizeof(header) + header.keySize + header.dataSize == fileSize;
+}
+
+static bool writeStageFile(string cacheDir, string stage, const string &key, const string &data)
+{
+    stage_cache_header_t header;
+    initStageHeader(header, key, data.size());
+    header.checksum = cacheChecksum(data.data(), data.size(),
+                                    cacheChecksum(key.data(), key.size(), CACHE_HASH_SEED));
+
+    mkdir(cacheDir.c_str(), 0755);
+    string cacheFile = stageCacheFile(cacheDir, stage, key);
+    string tmpFile = cacheTmpFile(cacheFile);
+    FILE *fp = fopen(tmpFile.c_str(), "wb");
+    bool ok = (fp != NULL);
+    if (ok)
+    {
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(key.data(), 1, key.size(), fp) == key.size() &&
+             fwrite(data.data(), 1, data.size(), fp) == data.size();
+        ok = (fclose(fp) == 0) && ok;
+    }
+    if (!ok || rename(tmpFile.c_str(), cacheFile.c_str()) != 0)
+    {
+        unlink(tmpFile.c_str());
+        LOG.err("WARNING: Could not write stage cache", cacheFile);
+        return false;
+    }
+    return true;
+}
+
+static bool readStageFile(string cacheDir, string stage, const string &key, string &data)
+{
+    string cacheFile = stageCacheFile(cacheDir, stage, key);
+    struct stat st;
+    if (stat(cacheFile.c_str(), &st) != 0) return false;
+    FILE *fp = fopen(cacheFile.c_str(), "rb");
+    if (fp == NULL) return false;
+
+    stage_cache_header_t header;
+    string storedKey(key.size(), '\0');
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              checkStageHeader(header, key, st.st_size) &&
+              fread(&(storedKey[0]), 1, key.size(), fp) == key.size() &&
+              storedKey.compare(key) == 0;
+    if (ok)
+    {
+        data.resize(header.dataSize);
+        ok = header.dataSize == 0 || fread(&(data[0]), 1, header.dataSize, fp) == header.dataSize;
+    }
+    fclose(fp);
+
+    ok = ok && cacheChecksum(data.data(), data.size(),
+                             cacheChecksum(key.data(), key.size(), CACHE_HASH_SEED)) == header.checksum;
+    if (!ok) data.clear();
+    return ok;
+}
+
+vector< FreqData * > *readFreqStage(string cacheDir, string key, vector< MapData * > *mapDataByChr)
+{
+    string data;
+    if (!readStageFile(cacheDir, "freq", key, data)) return NULL;
+
+    cache_cursor_t cur;
+    cur.p = data.data();
+    cur.end = cur.p + data.size();
+    cur.ok = true;
+
+    int nchr = getInt32(cur);
+    if (!cur.ok || nchr != (int)mapDataByChr->size()) return NULL;
+
+    vector< FreqData * > *freqDataByChr = new vector< FreqData * >;
+    for (int chr = 0; chr < nchr; chr++)
+    {
+        int nloci = getInt32(cur);
+        const char *freq = getBytes(cur, (size_t)mapDataByChr->at(chr)->nloci * sizeof(double));
+        if (!cur.ok || nloci != mapDataByChr->at(chr)->nloci)
+        {
+            releaseFreqData(freqDataByChr);
+            return NULL;
+        }
+        FreqData *freqData = initFreqData(nloci);
+        memcpy(freqData->freq, freq, (size_t)nloci * sizeof(double));
+        freqDataByChr->push_back(freqData);
+    }
+
+    cout << "Reusing allele frequencies from cache " << stageCacheFile(cacheDir, "freq", key) << "\n";
+    return freqDataByChr;
+}
+
+void writeFreqStage(string cacheDir, string key, vector< FreqData * > *freqDataByChr)
+{
+    string data;
+    putInt32(data, freqDataByChr->size());
+    for (unsigned int chr = 0; chr < freqDataByChr->size(); chr++)
+    {
+        FreqData *freqData = freqDataByChr->at(chr);
+        putInt32(data, freqData->nloci);
+        putBytes(data, freqData->freq, (size_t)freqData->nloci * sizeof(double));
+    }
+    writeStageFile(cacheDir, "freq", key, data);
+    return;
+}
+
+bool readKDEStage(string cacheDir, string key, kde_stage_t &stage)
+{
+    string data;
+    if (!readStageFile(cacheDir, "kde", key, data)) return false;
+
+    cache_cursor_t cur;
+    cur.p = data.data();
+    cur.end = cur.p + data.size();
+    cur.ok = true;
+
+    stage.winsize = getInt32(cur);
+    stage.lodCutoff = getDouble(cur);
+    stage.kdeText = getString(cur);
+    if (!cur.ok) return false;
+
+    cout << "Reusing the LOD score KDE from cache " << stageCacheFile(cacheDir, "kde", key) << "\n";
+    return true;
+}
+
+void writeKDEStage(string cacheDir, string key, const kde_stage_t &stage)
+{
+    string data;
+    putInt32(data, stage.winsize);
+    putDouble(data, stage.lodCutoff);
+    putString(data, stage.kdeText);
+    writeStageFile(cacheDir, "kde", key, data);
+    return;
+}
+
+//The stage data starts with the chromosome count, nind and each
+//chromosome's nloci, then the windows from the next 64 byte boundary.
+//Returns the file size.
+static size_t windowStageLayout(const string &key, vector< MapData * > *mapDataByChr, int nind,
+                                vector< size_t > &blockOffset)
+{
+    size_t offset = sizeof(stage_cache_header_t) + key.size() + sizeof(int32_t) * (2 + mapDataByChr->size());
+    offset = (offset + 63) / 64 * 64;
+    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
+    {
+        blockOffset.push_back(offset);
+        offset += (size_t)nind * mapDataByChr->at(chr)->nloci * sizeof(float);
+    }
+    return offset;
+}
+
+//Covers the key and layout up to the first block of scores
+static uint64_t windowStageChecksum(const char *base, size_t size, const vector< size_t > &blockOffset)
+{
+    size_t metaEnd = blockOffset.empty() ? size : blockOffset[0];
+    return cacheChecksum(base + sizeof(stage_cache_header_t), metaEnd - sizeof(stage_cache_header_t),
+                         CACHE_HASH_SEED);
+}
+
+static WindowStage *initWindowStage(char *base, size_t size, const vector< size_t > &blockOffset)
+{
+    WindowStage *stage = new WindowStage;
+    stage->base = base;
+    stage->size = size;
+    stage->scoresByChr = new vector< float * >;
+    for (unsigned int chr = 0; chr < blockOffset.size(); chr++)
+    {
+        stage->scoresByChr->push_back((float *)(base + blockOffset[chr]));
+    }
+    return stage;
+}
+
+WindowStage *openWindowStage(string cacheDir, string key,
+                             vector< MapData * > *mapDataByChr,
+                             IndData *indData)
+{
+    string cacheFile = stageCacheFile(cacheDir, "windows", key);
+    int fd = open(cacheFile.c_str(), O_RDONLY);
+    if (fd < 0) return NULL;
+
+    vector< size_t > blockOffset;
+    size_t size = windowStageLayout(key, mapDataByChr, indData->nind, blockOffset);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != size)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return NULL;
+    char *base = (char *)addr;
+
+    stage_cache_header_t header;
+    memcpy(&header, base, sizeof(header));
+    bool ok = checkStageHeader(header, key, size) &&
+              memcmp(base + sizeof(header), key.data(), key.size()) == 0;
+    if (ok)
+    {
+        cache_cursor_t cur;
+        cur.p = base + sizeof(header) + key.size();
+        cur.end = base + size;
+        cur.ok = true;
+        ok = getInt32(cur) == (int)mapDataByChr->size() && getInt32(cur) == indData->nind;
+        for (unsigned int chr = 0; ok && chr < mapDataByChr->size(); chr++)
+        {
+            ok = getInt32(cur) == mapDataByChr->at(chr)->nloci;
+        }
+    }
+    ok = ok && windowStageChecksum(base, size, blockOffset) == header.checksum;
+    if (!ok)
+    {
+        munmap(addr, size);
+        LOG.err("WARNING: Window score cache is damaged, rebuilding:", cacheFile);
+        return NULL;
+    }
+
+    cout << "Reusing window scores from cache " << cacheFile << "\n";
+    WindowStage *stage = initWindowStage(base, size, blockOffset);
+    stage->file = cacheFile;
+    return stage;
+}
+
+WindowStage *createWindowStage(string cacheDir, string key,
+                               vector< MapData * > *mapDataByChr,
+                               IndData *indData)
+{
+    mkdir(cacheDir.c_str(), 0755);
+    string cacheFile = stageCacheFile(cacheDir, "windows", key);
+    string tmpFile = cacheTmpFile(cacheFile);
+
+    vector< size_t > blockOffset;
+    size_t size = windowStageLayout(key, mapDataByChr, indData->nind, blockOffset);
+    int fd = open(tmpFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    void *addr = MAP_FAILED;
+    if (fd >= 0)
+    {
+        if (ftruncate(fd, size) == 0) addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (addr == MAP_FAILED)
+    {
+        unlink(tmpFile.c_str());
+        LOG.err("WARNING: Could not write stage cache", cacheFile);
+        return NULL;
+    }
+    char *base = (char *)addr;
+
+    stage_cache_header_t header;
+    initStageHeader(header, key, size - sizeof(header) - key.size());
+    memcpy(base, &header, sizeof(header));
+    memcpy(base + sizeof(header), key.data(), key.size());
+    string meta;
+    putInt32(meta, mapDataByChr->size());
+    putInt32(meta, indData->nind);
+    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++) putInt32(meta, mapDataByChr->at(chr)->nloci);
+    memcpy(base + sizeof(header) + key.size(), meta.data(), meta.size());
+
+    cout << "Writing window scores to cache " << cacheFile << "\n";
+    WindowStage *stage = initWindowStage(base, size, blockOffset);
+    stage->file = cacheFile;
+    stage->tmpFile = tmpFile;
+    return stage;
+}
+
+void commitWindowStage(WindowStage *stage)
+{
+    if (stage == NULL || stage->tmpFile.empty()) return;
+    stage_cache_header_t header;
+    memcpy(&header, stage->base, sizeof(header));
+    vector< size_t > blockOffset;
+    for (unsigned int chr = 0; chr < stage->scoresByChr->size(); chr++)
+    {
+        blockOffset.push_back((char *)stage->scoresByChr->at(chr) - stage->base);
+    }
+    header.checksum = windowStageChecksum(stage->base, stage->size, blockOffset);
+    memcpy(stage->base, &header, sizeof(header));
+    if (rename(stage->tmpFile.c_str(), stage->file.c_str()) != 0)
+    {
+        unlink(stage->tmpFile.c_str());
+        LOG.err("WARNING: Could not write stage cache", stage->file);
+    }
+    stage->tmpFile.clear();
+    return;
+}
+
+//A stage that was never committed is discarded
+void releaseWindowStage(WindowStage *stage)
+{
+    if (stage == NULL) return;
+    delete stage->scoresByChr;
+    munmap(stage->base, stage->size);
+    if (!stage->tmpFile.empty()) unlink(stage->tmpFile.c_str());
+    delete stage;
+    return;
+}
+
+void writeWindowStage(string cacheDir, string key,
+                      vector< WinData * > *winDataByChr,
+                      vector< MapData * > *mapDataByChr,
+                      IndData *indData)
+{
+    WindowStage *stage = createWindowStage(cacheDir, key, mapDataByChr, indData);
+    if (stage == NULL) return;
+    for (unsigned int chr = 0; chr < winDataByChr->size(); chr++)
+    {
+        WinData *winData = winDataByChr->at(chr);
+        float *scores = stage->scoresByChr->at(chr);
+        for (int ind = 0; ind < winData->nind; ind++)
+        {
+            for (int locus = 0; locus < winData->nloci; locus++)
+            {
+                *scores++ = winData->data[ind][locus];
+            }
+        }
+    }
+    commitWindowStage(stage);
+    releaseWindowStage(stage);
+    return;
+}
+
+#else
+
+bool readGenotypeCache(string cacheDir, const vector< string > &sourceFiles, char TPED_MISSING,
+                       IndData **indData,
+                       vector< MapData * > **mapDataByChr,
+                       vector< HapData * > **hapDataByChr,
+                       vector< int_pair_t > **chrCoordList,
+                       int &numLoci)
+{
+    LOG.err("WARNING: Genotype caches are not supported on this platform.");
+    return false;
+}
+
+void writeGenotypeCache(string cacheDir, const vector< string > &sourceFiles, char TPED_MISSING,
+                        IndData *indData,
+                        vector< MapData * > *mapDataByChr,
+                        vector< HapData * > *hapDataByChr)
+{
+    return;
+}
+
+string cacheInputKey(const vector< string > &sourceFiles)
+{
+    return "";
+}
+
+vector< FreqData * > *readFreqStage(string cacheDir, string key, vector< MapData * > *mapDataByChr)
+{
+    return NULL;
+}
+
+void writeFreqStage(string cacheDir, string key, vector< FreqData * > *freqDataByChr)
+{
+    return;
+}
+
+bool readKDEStage(string cacheDir, string key, kde_stage_t &stage)
+{
+    return false;
+}
+
+void writeKDEStage(string cacheDir, string key, const kde_stage_t &stage)
+{
+    return;
+}
+
+WindowStage *openWindowStage(string cacheDir, string key,
+                             vector< MapData * > *mapDataByChr,
+                             IndData *indData)
+{
+    return NULL;
+}
+
+WindowStage *createWindowStage(string cacheDir, string key,
+                               vector< MapData * > *mapDataByChr,
+                               IndData *indData)
+{
+    return NULL;
+}
+
+void commitWindowStage(WindowStage *stage)
+{
+    return;
+}
+
+void releaseWindowStage(WindowStage *stage)
+{
+    return;
+}
+
+void writeWindowStage(string cacheDir, string key,
+                      vector< WinData * > *winDataByChr,
+                      vector< MapData * > *mapDataByChr,
+                      IndData *indData)
+{
+    return;
+}
+
+#endif
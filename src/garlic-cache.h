@@ -0,0 +1,142 @@
+#ifndef __GARLIC_CACHE_H__
+#define __GARLIC_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "garlic-data.h"
+#include "garlic-errlog.h"
+
+using namespace std;
+
+const uint64_t CACHE_HASH_SEED = 14695981039346656037ULL;
+
+//A checksum of n bytes at p, continuing from h
+uint64_t cacheChecksum(const char *p, size_t n, uint64_t h);
+
+//Caches are written under a temporary name unique to the process and
+//renamed into place, so a run never sees one half written
+string cacheTmpFile(string cacheFile);
+
+const uint32_t GENO_CACHE_VERSION = 2;
+const int GENO_CACHE_MAX_SOURCES = 3;
+
+//Genotype blocks start on this boundary in the cache file so each
+//chromosome can be mapped on its own
+const uint64_t GENO_CACHE_ALIGN = 65536;
+
+//Bytes hashed from each end of an input file to detect edits that keep
+//its size and modification time
+const size_t CACHE_SAMPLE_BYTES = 65536;
+
+//What a cache remembers about one input file
+struct cache_source_t
+{
+    int64_t size;
+    int64_t mtime;
+    uint64_t sample;
+};
+
+//A genotype cache is this header, a metadata section holding the
+//population, individual IDs and per-chromosome maps and allele counts,
+//then each chromosome's packed genotypes.  The metadata is checksummed
+//so it can be trusted before it is parsed.  The genotypes are not, so a
+//load reads no more than the metadata; their blocks are only checked to
+//lie in order within the file.  They are read back through private
+//mappings, so later stages may still modify them.
+struct geno_cache_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nsource;
+    cache_source_t source[GENO_CACHE_MAX_SOURCES];
+    char TPED_MISSING;
+    char pad[7];
+    uint64_t metaSize;
+    uint64_t fileSize;
+    uint64_t metaChecksum;
+};
+
+//Fills the data and returns true if cacheDir holds a valid cache for
+//these input files.  Returns false, with nothing allocated, otherwise.
+bool readGenotypeCache(string cacheDir, const vector< string > &sourceFiles, char TPED_MISSING,
+                       IndData **indData,
+                       vector< MapData * > **mapDataByChr,
+                       vector< HapData * > **hapDataByChr,
+                       vector< int_pair_t > **chrCoordList,
+                       int &numLoci);
+
+//Failure to write the cache is reported but not fatal
+void writeGenotypeCache(string cacheDir, const vector< string > &sourceFiles, char TPED_MISSING,
+                        IndData *indData,
+                        vector< MapData * > *mapDataByChr,
+                        vector< HapData * > *hapDataByChr);
+
+//Stage results are stored under a key string naming every input and
+//parameter they depend on.  The file name is a hash of the key and the
+//key itself is kept in the file, so a stage is only reused on an exact
+//match.  Stage files are this header, the key, then the stage's data,
+//all covered by the checksum except for the window scores.
+const uint32_t STAGE_CACHE_VERSION = 2;
+
+struct stage_cache_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t keySize;
+    uint64_t dataSize;
+    uint64_t checksum;
+};
+
+//Describes input files for a stage key, or returns "" if any of them is
+//not a regular file
+string cacheInputKey(const vector< string > &sourceFiles);
+
+//Frequencies for every locus before monomorphic sites are filtered.
+//Returns NULL if there is no valid stage for key.
+vector< FreqData * > *readFreqStage(string cacheDir, string key, vector< MapData * > *mapDataByChr);
+void writeFreqStage(string cacheDir, string key, vector< FreqData * > *freqDataByChr);
+
+//The window size and LOD score cutoff taken from the LOD score KDE,
+//with the text of the KDE file written for that window size
+struct kde_stage_t
+{
+    int winsize;
+    double lodCutoff;
+    string kdeText;
+};
+
+bool readKDEStage(string cacheDir, string key, kde_stage_t &stage);
+void writeKDEStage(string cacheDir, string key, const kde_stage_t &stage);
+
+//Every individual's window scores in single precision, one block of
+//nind rows of nloci floats per chromosome.  scoresByChr points at each
+//block in a mapping of the stage file.  A new stage is filled in place
+//and only becomes visible to later runs once committed.  As with the
+//genotype cache, only the key and block layout are checksummed, so a
+//load touches no more of the scores than assembling ROH does.
+struct WindowStage
+{
+    string file;
+    string tmpFile;
+    char *base;
+    size_t size;
+    vector< float * > *scoresByChr;
+};
+
+WindowStage *openWindowStage(string cacheDir, string key,
+                             vector< MapData * > *mapDataByChr,
+                             IndData *indData);
+WindowStage *createWindowStage(string cacheDir, string key,
+                               vector< MapData * > *mapDataByChr,
+                               IndData *indData);
+void commitWindowStage(WindowStage *stage);
+void releaseWindowStage(WindowStage *stage);
+
+//Copies windows held in memory into a new stage
+void writeWindowStage(string cacheDir, string key,
+                      vector< WinData * > *winDataByChr,
+                      vector< MapData * > *mapDataByChr,
+                      IndData *indData);
+
+#endif
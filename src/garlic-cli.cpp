@@ -1,5 +1,6 @@
 #include "garlic-cli.h"
 #include <iostream>
+#include <sys/stat.h>
 
 const string VERSION = "1.0.1";
 
@@ -12,11 +13,13 @@ const string ARG_OUTFILE = "--out";
 const string DEFAULT_OUTFILE = "outfile";
 const string HELP_OUTFILE = "The base name for all output files.";
 
-/*
 const string ARG_THREADS = "--threads";
 const int DEFAULT_THREADS = 1;
-const string HELP_THREADS = "The number of threads to spawn during calculations.";
-*/
+const string HELP_THREADS = "The number of threads to spawn during calculations.  LOD scores are\n\
+\tcomputed in parallel over chromosomes and blocks of individuals,\n\
+\tcandidate window sizes are evaluated concurrently, the size class\n\
+\tGMM is fit in parallel, and BGZF compressed input is decompressed\n\
+\tblock-parallel when > 1.";
 
 const string ARG_ERROR = "--error";
 const double DEFAULT_ERROR = -1;
@@ -41,6 +44,14 @@ const string ARG_AUTO_WINSIZE_STEP = "--auto-winsize-step";
 const int DEFAULT_AUTO_WINSIZE_STEP = 10;
 const string HELP_AUTO_WINSIZE_STEP = "Step size for automatic window selection algorithm.";
 
+const string ARG_AUTO_WINSIZE_SEARCH = "--auto-winsize-search";
+const string DEFAULT_AUTO_WINSIZE_SEARCH = "linear";
+const string HELP_AUTO_WINSIZE_SEARCH = "Search strategy for automatic window selection.  'linear' tries every\n\
+\t<step size> from --winsize upwards.  'bracket' doubles the number of steps\n\
+\tuntil a window size passes and then bisects back down to one step.  Both\n\
+\tselect the same size when smoothness improves steadily with window size,\n\
+\tbut 'bracket' needs far fewer LOD/KDE evaluations.";
+
 const string ARG_MAX_GAP = "--max-gap";
 const int DEFAULT_MAX_GAP = 200000;
 const string HELP_MAX_GAP = "A LOD score window is not calculated if the gap (in bps)\n\
@@ -54,12 +65,24 @@ const string HELP_RESAMPLE = "Number of resamples for estimating allele frequenc
 
 const string ARG_TPED = "--tped";
 const string DEFAULT_TPED = "none";
-const string HELP_TPED = "A tped formatted file containing map and genotype information.";
+const string HELP_TPED = "A tped formatted file containing map and genotype information.\n\
+\tUse - to read from stdin.";
 
 const string ARG_TFAM = "--tfam";
 const string DEFAULT_TFAM = "none";
 const string HELP_TFAM = "A tfam formatted file containing population and individual IDs.";
 
+const string ARG_BFILE = "--bfile";
+const string DEFAULT_BFILE = "none";
+const string HELP_BFILE = "The prefix of a PLINK binary fileset (.bed/.bim/.fam) to use\n\
+\tin place of tped/tfam files.  The .bed file must be in SNP-major mode.";
+
+const string ARG_VCF = "--vcf";
+const string DEFAULT_VCF = "none";
+const string HELP_VCF = "A VCF file (optionally gzip compressed) to use in place of tped/tfam files.\n\
+\tGenotypes are taken from the GT field and all individuals are assigned\n\
+\tthe population ID 0.";
+
 const string ARG_RAW_LOD = "--raw-lod";
 const bool DEFAULT_RAW_LOD = false;
 const string HELP_RAW_LOD = "If set, LOD scores will be output to gzip compressed files.";
@@ -76,6 +99,24 @@ const string HELP_BOUND_SIZE = "Specify the short/medium and medium/long\n\
 \tROH boundaries.  By default, this is chosen automatically\n\
 \twith a 3-component GMM.  Must provide 2 numbers.";
 
+const string ARG_GMM_BIN_WIDTH = "--gmm-bin-width";
+const int DEFAULT_GMM_BIN_WIDTH = 0;
+const string HELP_GMM_BIN_WIDTH = "Fit the size class GMM to a histogram of ROH lengths with\n\
+\tbins of this many bps, each weighted by its count, instead of\n\
+\tto every length.  Much faster for very large numbers of ROH.\n\
+\t0 fits every length.";
+
+const string ARG_GMM_RESTARTS = "--gmm-restarts";
+const int DEFAULT_GMM_RESTARTS = 0;
+const string HELP_GMM_RESTARTS = "The number of extra k-means++ seeded starts for the size class\n\
+\tGMM.  All starts are run concurrently and the fit with the\n\
+\thighest likelihood is kept.";
+
+const string ARG_GMM_BIC = "--gmm-bic";
+const bool DEFAULT_GMM_BIC = false;
+const string HELP_GMM_BIC = "If set, also fits GMMs with 1 to 6 components and reports\n\
+\twhich the BIC prefers.  Size classes still come from 3 components.";
+
 const string ARG_TPED_MISSING = "--tped-missing";
 const char DEFAULT_TPED_MISSING = '0';
 const string HELP_TPED_MISSING = "Single character missing data code for TPED files.";
@@ -89,6 +130,31 @@ const string HELP_FREQ_FILE = "A file specifying allele frequencies for\n\
 \tBy default, this is calculated automatically\n\
 \tfrom the provided data.";
 
+const string ARG_CACHE = "--cache";
+const string DEFAULT_CACHE = "none";
+const string HELP_CACHE = "A directory in which to keep a binary copy of the parsed map,\n\
+\tindividuals and genotypes.  Later runs on the same input map\n\
+\tthe copy instead of parsing the input again.  The copy is\n\
+\trebuilt when the size, modification time or sampled contents of\n\
+\tan input file change.  Allele frequencies and the window size\n\
+\tand LOD score cutoff chosen from the KDE are kept there too, each\n\
+\treused by later runs whose inputs and settings for that step are\n\
+\tunchanged.";
+
+const string ARG_CACHE_WINDOWS = "--cache-windows";
+const bool DEFAULT_CACHE_WINDOWS = false;
+const string HELP_CACHE_WINDOWS = "If set, also keeps every individual's window scores in the\n\
+\t--cache directory, so reruns that only change the LOD score\n\
+\tcutoff, overlap fraction or size bounds skip scoring windows.\n\
+\tScores are kept in single precision and take 4 bytes per\n\
+\tindividual per locus for each window size.";
+
+const string ARG_FREQ_CACHE = "--freq-cache";
+const bool DEFAULT_FREQ_CACHE = false;
+const string HELP_FREQ_CACHE = "If set, keeps a binary copy of the --freq-file beside it\n\
+\t(<freq file>.cache) and reads frequencies from that copy on\n\
+\tlater runs.  The copy is rebuilt when the freq file changes.";
+
 const string ARG_FREQ_ONLY = "--freq-only";
 const bool DEFAULT_FREQ_ONLY = false;
 const string HELP_FREQ_ONLY = "If set, calculates a freq file from provided data and then exits.";
@@ -99,6 +165,17 @@ const string HELP_KDE_SUBSAMPLE = "The number of individuals to randomly sample
 \tare fewer individuals in the population all are used.\n\
 Set <= 0 to use all individuals (may use large amounts of RAM).";
 
+const string ARG_KDE_ENGINE = "--kde-engine";
+const string DEFAULT_KDE_ENGINE = "figtree";
+const string HELP_KDE_ENGINE = "How the LOD score KDE is evaluated.  'figtree' uses the FIGTree fast Gauss\n\
+\ttransform.  'fft' bins the LOD scores on a fine grid and convolves with the\n\
+\tkernel by FFT, which is much faster and uses little memory for large data.";
+
+const string ARG_KDE_BANDWIDTH = "--kde-bandwidth";
+const string DEFAULT_KDE_BANDWIDTH = "nrd0";
+const string HELP_KDE_BANDWIDTH = "Bandwidth selector for the LOD score KDE.  'nrd0' is Silverman's rule of\n\
+\tthumb, 'sj' the Sheather-Jones solve-the-equation selector on binned data.";
+
 const string ARG_BUILD = "--build";
 const string DEFAULT_BUILD = "none";
 const string HELP_BUILD = "Choose which genome build to use for centromere locations (hg18, hg19, or hg38).\n";
@@ -127,7 +204,7 @@ param_t *getCLI(int argc, char *argv[])
 	param_t *params = new param_t;
 	params->addFlag(ARG_OVERLAP_FRAC, DEFAULT_OVERLAP_FRAC, "", HELP_OVERLAP_FRAC);
 	params->addFlag(ARG_OUTFILE, DEFAULT_OUTFILE, "", HELP_OUTFILE);
-	//params->addFlag(ARG_THREADS, DEFAULT_THREADS, "", HELP_THREADS);
+	params->addFlag(ARG_THREADS, DEFAULT_THREADS, "", HELP_THREADS);
 	params->addFlag(ARG_ERROR, DEFAULT_ERROR, "", HELP_ERROR);
 	params->addFlag(ARG_WINSIZE, DEFAULT_WINSIZE, "", HELP_WINSIZE);
 	//params->addFlag(ARG_POINTS, DEFAULT_POINTS, "", HELP_POINTS);
@@ -136,19 +213,30 @@ param_t *getCLI(int argc, char *argv[])
 	params->addFlag(ARG_RESAMPLE, DEFAULT_RESAMPLE, "", HELP_RESAMPLE);
 	params->addFlag(ARG_TPED, DEFAULT_TPED, "", HELP_TPED);
 	params->addFlag(ARG_TFAM, DEFAULT_TFAM, "", HELP_TFAM);
+	params->addFlag(ARG_BFILE, DEFAULT_BFILE, "", HELP_BFILE);
+	params->addFlag(ARG_VCF, DEFAULT_VCF, "", HELP_VCF);
+	params->addFlag(ARG_CACHE, DEFAULT_CACHE, "", HELP_CACHE);
+	params->addFlag(ARG_CACHE_WINDOWS, DEFAULT_CACHE_WINDOWS, "", HELP_CACHE_WINDOWS);
 	params->addFlag(ARG_RAW_LOD, DEFAULT_RAW_LOD, "", HELP_RAW_LOD);
 	params->addListFlag(ARG_BOUND_SIZE, DEFAULT_BOUND_SIZE, "", HELP_BOUND_SIZE);
+	params->addFlag(ARG_GMM_BIN_WIDTH, DEFAULT_GMM_BIN_WIDTH, "", HELP_GMM_BIN_WIDTH);
+	params->addFlag(ARG_GMM_RESTARTS, DEFAULT_GMM_RESTARTS, "", HELP_GMM_RESTARTS);
+	params->addFlag(ARG_GMM_BIC, DEFAULT_GMM_BIC, "", HELP_GMM_BIC);
 	params->addFlag(ARG_LOD_CUTOFF, DEFAULT_LOD_CUTOFF, "", HELP_LOD_CUTOFF);
 	//params->addFlag(ARG_LOD_CUTOFF_FILE, DEFAULT_LOD_CUTOFF_FILE, "", HELP_LOD_CUTOFF_FILE);
 	//params->addFlag(ARG_BOUND_SIZE_FILE, DEFAULT_BOUND_SIZE_FILE, "", HELP_BOUND_SIZE_FILE);
 	params->addFlag(ARG_TPED_MISSING, DEFAULT_TPED_MISSING, "", HELP_TPED_MISSING);
 	params->addFlag(ARG_FREQ_FILE, DEFAULT_FREQ_FILE, "", HELP_FREQ_FILE);
+	params->addFlag(ARG_FREQ_CACHE, DEFAULT_FREQ_CACHE, "", HELP_FREQ_CACHE);
 	params->addFlag(ARG_FREQ_ONLY, DEFAULT_FREQ_ONLY, "", HELP_FREQ_ONLY);
 	params->addListFlag(ARG_WINSIZE_MULTI, DEFAULT_WINSIZE_MULTI, "", HELP_WINSIZE_MULTI);
 	//params->addFlag(ARG_POP_SPLIT, DEFAULT_POP_SPLIT , "", HELP_POP_SPLIT);
 	params->addFlag(ARG_KDE_SUBSAMPLE, DEFAULT_KDE_SUBSAMPLE , "", HELP_KDE_SUBSAMPLE);
+	params->addFlag(ARG_KDE_ENGINE, DEFAULT_KDE_ENGINE, "", HELP_KDE_ENGINE);
+	params->addFlag(ARG_KDE_BANDWIDTH, DEFAULT_KDE_BANDWIDTH, "", HELP_KDE_BANDWIDTH);
 	params->addFlag(ARG_AUTO_WINSIZE, DEFAULT_AUTO_WINSIZE, "", HELP_AUTO_WINSIZE);
 	params->addFlag(ARG_AUTO_WINSIZE_STEP, DEFAULT_AUTO_WINSIZE_STEP, "", HELP_AUTO_WINSIZE_STEP);
+	params->addFlag(ARG_AUTO_WINSIZE_SEARCH, DEFAULT_AUTO_WINSIZE_SEARCH, "", HELP_AUTO_WINSIZE_SEARCH);
 	params->addFlag(ARG_BUILD, DEFAULT_BUILD, "", HELP_BUILD);
 	params->addFlag(ARG_CENTROMERE_FILE, DEFAULT_CENTROMERE_FILE, "", HELP_CENTROMERE_FILE);
 
@@ -218,6 +306,28 @@ bool checkAutoFreq(string freqfile, bool FREQ_ONLY, bool &AUTO_FREQ)
 	return false;
 }
 
+bool checkCacheDir(string cacheDir)
+{
+	struct stat st;
+	if (stat(cacheDir.c_str(), &st) == 0 && !S_ISDIR(st.st_mode))
+	{
+		LOG.err("ERROR: Cache location is not a directory:", cacheDir);
+		return true;
+	}
+	return false;
+}
+
+bool checkCacheWindows(bool CACHE, bool CACHE_WINDOWS)
+{
+	if (CACHE_WINDOWS && !CACHE)
+	{
+		LOG.err("ERROR: Must set", ARG_CACHE, false);
+		LOG.err(" to use", ARG_CACHE_WINDOWS);
+		return true;
+	}
+	return false;
+}
+
 bool checkAutoWinsizeStep(int auto_winsize_step){
 	if(auto_winsize_step <= 0){
 		LOG.err("ERROR: Step size for automatic window selection must be positive.");
@@ -226,6 +336,30 @@ bool checkAutoWinsizeStep(int auto_winsize_step){
 	return false;
 }
 
+bool checkAutoWinsizeSearch(string search){
+	if(search.compare("linear") != 0 && search.compare("bracket") != 0){
+		LOG.err("ERROR: Must choose linear or bracket for", ARG_AUTO_WINSIZE_SEARCH);
+		return true;
+	}
+	return false;
+}
+
+bool checkKDEEngine(string engine){
+	if(engine.compare("figtree") != 0 && engine.compare("fft") != 0){
+		LOG.err("ERROR: Must choose figtree or fft for", ARG_KDE_ENGINE);
+		return true;
+	}
+	return false;
+}
+
+bool checkKDEBandwidth(string selector){
+	if(selector.compare("nrd0") != 0 && selector.compare("sj") != 0){
+		LOG.err("ERROR: Must choose nrd0 or sj for", ARG_KDE_BANDWIDTH);
+		return true;
+	}
+	return false;
+}
+
 bool checkAutoWinsize(bool WINSIZE_EXPLORE, bool AUTO_WINSIZE)
 {
 	//Check if both AUTO_WINSIZE and WINSIZE_EXPLORE are set
@@ -281,12 +415,43 @@ bool checkBoundSizes(vector<double> &boundSizes, bool &AUTO_BOUNDS)
 	return false;
 }
 
-bool checkRequiredFiles(string tpedfile, string tfamfile)
+bool checkGMMBinWidth(int binWidth)
+{
+	if (binWidth < 0)
+	{
+		LOG.err("ERROR: GMM bin width must be non-negative.");
+		return true;
+	}
+	return false;
+}
+
+bool checkGMMRestarts(int restarts)
+{
+	if (restarts < 0)
+	{
+		LOG.err("ERROR: Number of GMM restarts must be non-negative.");
+		return true;
+	}
+	return false;
+}
+
+bool checkRequiredFiles(string tpedfile, string tfamfile, string bfile, string vcffile)
 {
+	bool TPED = (tpedfile.compare(DEFAULT_TPED) != 0 || tfamfile.compare(DEFAULT_TFAM) != 0);
+	bool BFILE = (bfile.compare(DEFAULT_BFILE) != 0);
+	bool VCF = (vcffile.compare(DEFAULT_VCF) != 0);
+	if (int(TPED) + int(BFILE) + int(VCF) > 1)
+	{
+		LOG.err("ERROR: Must provide only one of tped/tfam files,", ARG_BFILE, false);
+		LOG.err(", or", ARG_VCF);
+		return true;
+	}
+	if (BFILE || VCF) return false;
 	if (tpedfile.compare(DEFAULT_TPED) == 0 || tfamfile.compare(DEFAULT_TFAM) == 0)
 	{
 		//cerr << "ERROR: Must provide both a tped and a tfam file.\n";
-		LOG.err("ERROR: Must provide both a tped and a tfam file.");
+		LOG.err("ERROR: Must provide both a tped and a tfam file,", ARG_BFILE, false);
+		LOG.err(", or", ARG_VCF);
 		return true;
 	}
 	return false;
@@ -18,11 +18,9 @@ extern const string ARG_OUTFILE;
 extern const string DEFAULT_OUTFILE;
 extern const string HELP_OUTFILE;
 
-/*
 extern const string ARG_THREADS;
 extern const int DEFAULT_THREADS;
 extern const string HELP_THREADS;
-*/
 
 extern const string ARG_ERROR;
 extern const double DEFAULT_ERROR;
@@ -44,6 +42,10 @@ extern const string ARG_AUTO_WINSIZE_STEP;
 extern const int DEFAULT_AUTO_WINSIZE_STEP;
 extern const string HELP_AUTO_WINSIZE_STEP;
 
+extern const string ARG_AUTO_WINSIZE_SEARCH;
+extern const string DEFAULT_AUTO_WINSIZE_SEARCH;
+extern const string HELP_AUTO_WINSIZE_SEARCH;
+
 extern const string ARG_MAX_GAP;
 extern const int DEFAULT_MAX_GAP;
 extern const string HELP_MAX_GAP;
@@ -60,6 +62,14 @@ extern const string ARG_TFAM;
 extern const string DEFAULT_TFAM;
 extern const string HELP_TFAM;
 
+extern const string ARG_BFILE;
+extern const string DEFAULT_BFILE;
+extern const string HELP_BFILE;
+
+extern const string ARG_VCF;
+extern const string DEFAULT_VCF;
+extern const string HELP_VCF;
+
 extern const string ARG_RAW_LOD;
 extern const bool DEFAULT_RAW_LOD;
 extern const string HELP_RAW_LOD;
@@ -72,6 +82,18 @@ extern const string ARG_BOUND_SIZE;
 extern const double DEFAULT_BOUND_SIZE;
 extern const string HELP_BOUND_SIZE;
 
+extern const string ARG_GMM_BIN_WIDTH;
+extern const int DEFAULT_GMM_BIN_WIDTH;
+extern const string HELP_GMM_BIN_WIDTH;
+
+extern const string ARG_GMM_RESTARTS;
+extern const int DEFAULT_GMM_RESTARTS;
+extern const string HELP_GMM_RESTARTS;
+
+extern const string ARG_GMM_BIC;
+extern const bool DEFAULT_GMM_BIC;
+extern const string HELP_GMM_BIC;
+
 extern const string ARG_TPED_MISSING;
 extern const char DEFAULT_TPED_MISSING;
 extern const string HELP_TPED_MISSING;
@@ -80,6 +102,18 @@ extern const string ARG_FREQ_FILE;
 extern const string DEFAULT_FREQ_FILE;
 extern const string HELP_FREQ_FILE;
 
+extern const string ARG_CACHE;
+extern const string DEFAULT_CACHE;
+extern const string HELP_CACHE;
+
+extern const string ARG_CACHE_WINDOWS;
+extern const bool DEFAULT_CACHE_WINDOWS;
+extern const string HELP_CACHE_WINDOWS;
+
+extern const string ARG_FREQ_CACHE;
+extern const bool DEFAULT_FREQ_CACHE;
+extern const string HELP_FREQ_CACHE;
+
 extern const string ARG_FREQ_ONLY;
 extern const bool DEFAULT_FREQ_ONLY;
 extern const string HELP_FREQ_ONLY;
@@ -88,6 +122,14 @@ extern const string ARG_KDE_SUBSAMPLE;
 extern const int DEFAULT_KDE_SUBSAMPLE;
 extern const string HELP_KDE_SUBSAMPLE;
 
+extern const string ARG_KDE_ENGINE;
+extern const string DEFAULT_KDE_ENGINE;
+extern const string HELP_KDE_ENGINE;
+
+extern const string ARG_KDE_BANDWIDTH;
+extern const string DEFAULT_KDE_BANDWIDTH;
+extern const string HELP_KDE_BANDWIDTH;
+
 extern const string ARG_BUILD;
 extern const string DEFAULT_BUILD;
 extern const string HELP_BUILD;
@@ -114,11 +156,18 @@ bool checkBuild(string BUILD);
 bool checkBuildAndCentromereFile(string BUILD, string centromereFile);
 bool checkMultiWinsizes(vector<int> &multiWinsizes, bool &WINSIZE_EXPLORE);
 bool checkAutoFreq(string freqfile, bool FREQ_ONLY, bool &AUTO_FREQ);
+bool checkCacheDir(string cacheDir);
+bool checkCacheWindows(bool CACHE, bool CACHE_WINDOWS);
 bool checkAutoWinsizeStep(int auto_winsize_step);
+bool checkAutoWinsizeSearch(string search);
+bool checkKDEEngine(string engine);
+bool checkKDEBandwidth(string selector);
 bool checkAutoWinsize(bool WINSIZE_EXPLORE, bool AUTO_WINSIZE);
 bool checkAutoCutoff(double LOD_CUTOFF, bool &AUTO_CUTOFF);
 bool checkBoundSizes(vector<double> &boundSizes, bool &AUTO_BOUNDS);
-bool checkRequiredFiles(string tpedfile, string tfamfile);
+bool checkGMMBinWidth(int binWidth);
+bool checkGMMRestarts(int restarts);
+bool checkRequiredFiles(string tpedfile, string tfamfile, string bfile, string vcffile);
 bool checkThreads(int numThreads);
 bool checkError(double error);
 bool checkWinsize(int winsize);
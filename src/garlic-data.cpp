@@ -1,110 +1,81 @@
 #include "garlic-data.h"
+#include "garlic-cache.h"
 
 int filterMonomorphicSites(vector< MapData * > **mapDataByChr,
                            vector< HapData * > **hapDataByChr,
                            vector< FreqData * > **freqDataByChr)
 {
-    vector< MapData * > *mapDataByChr2 = new vector< MapData * >;
-    vector< HapData * > *hapDataByChr2 = new vector< HapData * >;
-    vector< FreqData * > *freqDataByChr2 = new vector< FreqData * >;
-
     int numLoci = 0;
-    for (int i = 0; i < (*mapDataByChr)->size(); i++) {
-        int newLoci = 0;
-        MapData *mapData2 = filterMonomorphicSites((*mapDataByChr)->at(i), (*freqDataByChr)->at(i), newLoci);
-        HapData *hapData2 = filterMonomorphicSites((*hapDataByChr)->at(i), (*freqDataByChr)->at(i), newLoci);
-        FreqData *freqData2 = filterMonomorphicSites((*freqDataByChr)->at(i), newLoci);
-        mapDataByChr2->push_back(mapData2);
-        hapDataByChr2->push_back(hapData2);
-        freqDataByChr2->push_back(freqData2);
-        numLoci += newLoci;
-    }
-    
-    releaseMapData(*mapDataByChr);
-    releaseHapData(*hapDataByChr);
-    releaseFreqData(*freqDataByChr);
-
-    *mapDataByChr = mapDataByChr2;
-    *hapDataByChr = hapDataByChr2;
-    *freqDataByChr = freqDataByChr2;
-
-    return numLoci;
-}
-
-MapData *filterMonomorphicSites(MapData *mapData, FreqData *freqData, int &newLoci)
-{
-    if (newLoci <= 0) {
-        newLoci = 0;
-        for (int i = 0; i < freqData->nloci; i++)
-            if (freqData->freq[i] > 0 && freqData->freq[i] < 1)
-                newLoci++;
-    }
-
-    MapData *mapData2 = initMapData(newLoci);
-    mapData2->chr = mapData->chr;
-    int index = 0;
-    for (int i = 0; i < freqData->nloci; i++)
-    {
-        if (freqData->freq[i] > 0 && freqData->freq[i] < 1)
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < (*mapDataByChr)->size(); i++) {
+        MapData *mapData = (*mapDataByChr)->at(i);
+        HapData *hapData = (*hapDataByChr)->at(i);
+        FreqData *freqData = (*freqDataByChr)->at(i);
+        int newLoci = filterMonomorphicSites(mapData, hapData, freqData);
+
+        //A user provided frequency file need not cover every chromosome
+        if (newLoci == 0)
         {
-            mapData2->physicalPos[index] = mapData->physicalPos[i];
-            mapData2->geneticPos[index] = mapData->geneticPos[i];
-            mapData2->locusName[index] = mapData->physicalPos[i];
-            mapData2->allele[index] = mapData->allele[i];
-            index++;
+            LOG.err("WARNING: No polymorphic loci remain on chromosome", mapData->chr, false);
+            LOG.err(", dropped from analysis.");
+            releaseMapData(mapData);
+            releaseHapData(hapData);
+            releaseFreqData(freqData);
+            continue;
         }
-    }
-
-    return mapData2;
-}
 
-HapData *filterMonomorphicSites(HapData *hapData, FreqData *freqData, int &newLoci)
-{
-    if (newLoci <= 0) {
-        newLoci = 0;
-        for (int i = 0; i < freqData->nloci; i++)
-            if (freqData->freq[i] > 0 && freqData->freq[i] < 1)
-                newLoci++;
+        (*mapDataByChr)->at(kept) = mapData;
+        (*hapDataByChr)->at(kept) = hapData;
+        (*freqDataByChr)->at(kept) = freqData;
+        kept++;
+        numLoci += newLoci;
     }
+    (*mapDataByChr)->resize(kept);
+    (*hapDataByChr)->resize(kept);
+    (*freqDataByChr)->resize(kept);
 
-    HapData *hapData2 = initHapData(hapData->nind, newLoci);
-    int index = 0;
-    for (int i = 0; i < freqData->nloci; i++)
+    if (numLoci == 0)
     {
-        if (freqData->freq[i] > 0 && freqData->freq[i] < 1)
-        {
-            for (int j = 0; j < hapData->nind; j++)
-            {
-                hapData2->data[index][j] = hapData->data[i][j];
-            }
-            index++;
-        }
+        LOG.err("ERROR: No polymorphic loci remain for analysis.");
+        throw 0;
     }
-
-    return hapData2;
+    return numLoci;
 }
 
-FreqData *filterMonomorphicSites(FreqData *freqData, int &newLoci)
+//Retained loci are moved down over the dropped ones, so no second copy
+//of the genotypes is ever made.  The arrays keep their original
+//allocations; only nloci shrinks.
+int filterMonomorphicSites(MapData *mapData, HapData *hapData, FreqData *freqData)
 {
-    if (newLoci <= 0) {
-        newLoci = 0;
-        for (int i = 0; i < freqData->nloci; i++)
-            if (freqData->freq[i] > 0 && freqData->freq[i] < 1)
-                newLoci++;
-    }
-
-    FreqData *freqData2 = initFreqData(newLoci);
+    size_t rowBytes = hapData->wordsPerLocus * sizeof(uint64_t);
+    bool counted = (hapData->alleleCount != NULL && hapData->calledCount != NULL);
     int index = 0;
     for (int i = 0; i < freqData->nloci; i++)
     {
         if (freqData->freq[i] > 0 && freqData->freq[i] < 1)
         {
-            freqData2->freq[index] = freqData->freq[i];
+            if (index != i)
+            {
+                mapData->physicalPos[index] = mapData->physicalPos[i];
+                mapData->geneticPos[index] = mapData->geneticPos[i];
+                mapData->locusName[index].swap(mapData->locusName[i]);
+                mapData->allele[index] = mapData->allele[i];
+                memcpy(getHapLocus(hapData, index), getHapLocus(hapData, i), rowBytes);
+                if (counted)
+                {
+                    hapData->alleleCount[index] = hapData->alleleCount[i];
+                    hapData->calledCount[index] = hapData->calledCount[i];
+                }
+                freqData->freq[index] = freqData->freq[i];
+            }
             index++;
         }
     }
 
-    return freqData2;
+    mapData->nloci = index;
+    hapData->nloci = index;
+    freqData->nloci = index;
+    return index;
 }
 /*
 int filterMonomorphicSites(MapData &mapData,
@@ -167,39 +138,41 @@ bool goodDouble(string str)
     return 1;
 }
 
+//Uses the counts tallied by the loaders when present.  Resampling draws
+//the number of first alleles among nresample from a single binomial.
 FreqData *calcFreqData(HapData *hapData, int nresample, const gsl_rng *r)
 {
     FreqData *freqData = initFreqData(hapData->nloci);
-    double total, freq, count;
+    double total, freq;
 
     for (int locus = 0; locus < hapData->nloci; locus++)
     {
-        total = 0;
-        count = 0;
-        for (int ind = 0; ind < hapData->nind; ind++)
+        int alleles, called;
+        if (hapData->alleleCount != NULL)
         {
-            if (hapData->data[locus][ind] != -9)
-            {
-                count += hapData->data[locus][ind];
-                total += 2;
-            }
+            alleles = hapData->alleleCount[locus];
+            called = hapData->calledCount[locus];
         }
-        freq = count / total;
-        if (nresample == 0) freqData->freq[locus] = freq;
-        else
+        else countHapRow(getHapLocus(hapData, locus), hapData->wordsPerLocus, hapData->nind, alleles, called);
+
+        //No called genotypes leaves the frequency MISSING, and the
+        //locus is dropped as monomorphic
+        if (called == 0)
         {
-            count = 0;
-            for (int i = 0; i < nresample; i++)
-            {
-                if (gsl_rng_uniform(r) <= freq) count++;
-            }
-            freqData->freq[locus] = count / nresample;
+            freqData->freq[locus] = MISSING;
+            continue;
         }
 
+        total = 2 * called;
+        freq = alleles / total;
+        if (nresample == 0) freqData->freq[locus] = freq;
+        else freqData->freq[locus] = double(gsl_ran_binomial(r, freq, nresample)) / nresample;
     }
     return freqData;
 }
 
+//Each chromosome draws from its own stream, seeded in order from one
+//time-seeded generator
 vector< FreqData * > *calcFreqData2(vector< HapData * > *hapDataByChr, int nresample)
 {
     const gsl_rng_type *T;
@@ -207,14 +180,17 @@ vector< FreqData * > *calcFreqData2(vector< HapData * > *hapDataByChr, int nresa
     T = gsl_rng_default;
     r = gsl_rng_alloc (T);
     gsl_rng_set(r, time(NULL));
+    gsl_rng *chrRNG = gsl_rng_alloc(T);
 
     vector< FreqData * > *freqDataByChr = new vector< FreqData * >;
     for (unsigned int chr = 0; chr < hapDataByChr->size(); chr++)
     {
-        FreqData *data = calcFreqData(hapDataByChr->at(chr), nresample, r);
+        gsl_rng_set(chrRNG, gsl_rng_get(r));
+        FreqData *data = calcFreqData(hapDataByChr->at(chr), nresample, chrRNG);
         freqDataByChr->push_back(data);
     }
 
+    gsl_rng_free(chrRNG);
     gsl_rng_free(r);
 
     return freqDataByChr;
@@ -300,77 +276,193 @@ void writeFreqData(string freqOutfile, string popName,
     return;
 }
 
-vector< FreqData * > *readFreqData(string freqfile, string popName,
-                                   vector< int_pair_t > *chrCoordList,
-                                   vector< MapData * > *mapDataByChr)
+//Map loci are looked up by SNP ID through an open addressing table.
+//Loci sharing an ID are chained in map order, and each row of the
+//frequency file with that ID fills the next one still unset.
+struct locus_index_t
+{
+    vector< int > chr;
+    vector< int > locus;
+    vector< const string * > name;
+    vector< int > next;
+    vector< int > cursor;
+    vector< int > slot;
+    size_t mask;
+    int nset;
+};
+
+static uint64_t hashLocusID(const char *id, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)id[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void initLocusIndex(locus_index_t &index, vector< MapData * > *mapDataByChr)
 {
-    //scan file for format integrity
-    int minCols = 3;
-    int expectedRows = 1;
+    size_t nloci = 0;
+    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++) nloci += mapDataByChr->at(chr)->nloci;
 
+    size_t nslots = 16;
+    while (nslots < 2 * nloci) nslots <<= 1;
+    index.mask = nslots - 1;
+    index.slot.assign(nslots, -1);
+    index.nset = 0;
+
+    vector< int > tail(nslots, -1);
     for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
     {
-        expectedRows += mapDataByChr->at(chr)->nloci;
+        MapData *mapData = mapDataByChr->at(chr);
+        for (int locus = 0; locus < mapData->nloci; locus++)
+        {
+            const string &id = mapData->locusName[locus];
+            int e = index.name.size();
+            index.chr.push_back(chr);
+            index.locus.push_back(locus);
+            index.name.push_back(&id);
+            index.next.push_back(-1);
+            index.cursor.push_back(e);
+
+            size_t s = hashLocusID(id.data(), id.size()) & index.mask;
+            while (index.slot[s] >= 0 && index.name[index.slot[s]]->compare(id) != 0) s = (s + 1) & index.mask;
+            if (index.slot[s] < 0) index.slot[s] = e;
+            else index.next[tail[s]] = e;
+            tail[s] = e;
+        }
     }
+    return;
+}
 
-    igzstream fin;
-    fin.open(freqfile.c_str());
-    if (fin.fail())
+//Returns the first locus with this ID, or -1
+static int findLocusID(const locus_index_t &index, const char *id, size_t len)
+{
+    size_t s = hashLocusID(id, len) & index.mask;
+    while (index.slot[s] >= 0)
     {
-        cerr << "ERROR: Failed to open " << freqfile << " for reading.\n";
-        LOG.err("ERROR: Failed to open", freqfile);
-        throw 0;
+        const string *name = index.name[index.slot[s]];
+        if (name->size() == len && memcmp(name->data(), id, len) == 0) return index.slot[s];
+        s = (s + 1) & index.mask;
     }
-    cerr << "Reading " << freqfile << "\n";
-    string line;
-    int currentRows = 0;
-    int currentCols = 0;
-    int previousCols = -1;
-    while (getline(fin, line))
-    {
-        currentRows++;
-        currentCols = countFields(line);
-        if (currentCols < minCols)
+    return -1;
+}
+
+//False if the ID is not in the map or every locus with it is already set
+static bool setLocusFreq(locus_index_t &index, const char *id, size_t len, char allele, double freq,
+                         vector< MapData * > *mapDataByChr,
+                         vector< FreqData * > *freqDataByChr)
+{
+    int head = findLocusID(index, id, len);
+    if (head < 0 || index.cursor[head] < 0) return false;
+    int e = index.cursor[head];
+    index.cursor[head] = index.next[e];
+    mapDataByChr->at(index.chr[e])->allele[index.locus[e]] = allele;
+    freqDataByChr->at(index.chr[e])->freq[index.locus[e]] = freq;
+    index.nset++;
+    return true;
+}
+
+static const double EXACT_POW10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//Parses the number at p and moves p past it.  A mantissa of at most
+//2^53 scaled by at most 10^22 is exact in a double, so one multiply or
+//divide rounds the same way strtod does; everything else goes through
+//strtod.
+static bool parseFreqValue(const char *&p, double &val)
+{
+    const char *start = p;
+    const char *q = p;
+    bool neg = (*q == '-');
+    if (*q == '-' || *q == '+') q++;
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool any = false;
+    while (isdigit((unsigned char)*q))
+    {
+        mantissa = mantissa * 10 + (*q - '0');
+        if (mantissa != 0) digits++;
+        any = true;
+        q++;
+    }
+    if (*q == '.')
+    {
+        q++;
+        while (isdigit((unsigned char)*q))
         {
-            cerr << "ERROR: Found " << currentCols << " in " << freqfile
-                 << " on line " << currentRows << " but expected at least "
-                 << minCols << ".\n";
-            LOG.err("ERROR: Found", currentCols, false);
-            LOG.err(" in", freqfile, false);
-            LOG.err(" on line", currentRows, false);
-            LOG.err(" but expected at least", minCols);
-            throw 0;
+            mantissa = mantissa * 10 + (*q - '0');
+            if (mantissa != 0) digits++;
+            exp10--;
+            any = true;
+            q++;
         }
-        if (currentCols != previousCols && previousCols != -1)
+    }
+    if (any && (*q == 'e' || *q == 'E'))
+    {
+        const char *r = q + 1;
+        bool negExp = (*r == '-');
+        if (*r == '-' || *r == '+') r++;
+        if (isdigit((unsigned char)*r))
         {
-            cerr << "ERROR: " << freqfile << " has differing number of columns across rows.\n";
-            LOG.err("ERROR: Differing number of columns across rows found in", freqfile);
-            throw 0;
+            int e = 0;
+            while (isdigit((unsigned char)*r))
+            {
+                if (e < 10000) e = e * 10 + (*r - '0');
+                r++;
+            }
+            exp10 += negExp ? -e : e;
+            q = r;
         }
-        previousCols = currentCols;
     }
 
-    if (currentRows != expectedRows)
+    if (any && digits <= 19 && mantissa <= (uint64_t(1) << 53) && exp10 >= -22 && exp10 <= 22)
     {
-        cerr << "ERROR: " << freqfile << " has " << currentRows << " rows but expected "
-             << expectedRows << ".\n";
-        LOG.err("ERROR:", freqfile, false);
-        LOG.err(" has", currentRows, false);
-        LOG.err(" rows but expected", expectedRows);
-        throw 0;
+        val = (exp10 < 0) ? double(mantissa) / EXACT_POW10[-exp10] : double(mantissa) * EXACT_POW10[exp10];
+        if (neg) val = -val;
+        p = q;
+        return true;
     }
 
-    fin.close();
-    fin.clear();
+    char *end;
+    val = strtod(start, &end);
+    if (end == start) return false;
+    p = end;
+    return true;
+}
 
-    //allocate
-    vector< FreqData * > *freqDataByChr = new vector< FreqData * >;
-    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
-    {
-        FreqData *data = initFreqData(mapDataByChr->at(chr)->nloci);
-        freqDataByChr->push_back(data);
-    }
+static inline const char *skipSpace(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+    return p;
+}
+
+static inline const char *skipField(const char *p)
+{
+    while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    return p;
+}
+
+static void freqFileError(string freqfile, int row)
+{
+    LOG.err("ERROR: Missing or malformed frequency on line", row, false);
+    LOG.err(" of", freqfile);
+    return;
+}
 
+//Parses just the population's column of each row
+static void readFreqText(string freqfile, string popName, locus_index_t &index,
+                         vector< MapData * > *mapDataByChr,
+                         vector< FreqData * > *freqDataByChr,
+                         int &unmatched)
+{
+    igzstream fin;
     fin.open(freqfile.c_str());
     if (fin.fail())
     {
@@ -379,10 +471,7 @@ vector< FreqData * > *readFreqData(string freqfile, string popName,
         throw 0;
     }
 
-    //cerr << "Loading frequencies...\n";
-
     string header, junk;
-    //int popsFound = 0;
     getline(fin, header);
     int headerSize = countFields(header) - 2;
     stringstream ss;
@@ -403,37 +492,355 @@ vector< FreqData * > *readFreqData(string freqfile, string popName,
         throw 0;
     }
 
-    string locusID;//, allele;
-    char allele;
-    double freq;
-    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
+    string line;
+    int row = 1;
+    while (getline(fin, line))
     {
-        for (int locus = 0; locus < mapDataByChr->at(chr)->nloci; locus++)
+        row++;
+        const char *p = skipSpace(line.c_str());
+        if (*p == '\0') continue;
+
+        const char *id = p;
+        p = skipField(p);
+        size_t idLen = p - id;
+        p = skipSpace(p);
+        char allele = *p;
+        p = skipField(p);
+        for (int i = 0; i < popLocation; i++) p = skipField(skipSpace(p));
+        p = skipSpace(p);
+
+        double freq;
+        if (allele == '\0' || *p == '\0' || !parseFreqValue(p, freq) ||
+                (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r'))
         {
-            fin >> locusID >> allele;
-            if (mapDataByChr->at(chr)->locusName[locus].compare(locusID) != 0)
-            {
-                cerr << "ERROR: Loci appear out of order in " << freqfile << " relative to other files.\n";
-                LOG.err("ERROR: Loci appear out of order in", freqfile);
-                throw 0;
-            }
-            else
-            {
-                mapDataByChr->at(chr)->allele[locus] = allele;
-            }
+            freqFileError(freqfile, row);
+            throw 0;
+        }
+
+        if (!setLocusFreq(index, id, idLen, allele, freq, mapDataByChr, freqDataByChr)) unmatched++;
+    }
+
+    fin.close();
+    return;
+}
+
+#ifndef _WIN32
+
+const char FREQ_CACHE_MAGIC[8] = {'G', 'A', 'R', 'L', 'F', 'R', 'Q', '\0'};
+const uint32_t FREQ_CACHE_VERSION = 2;
+
+//A frequency file cache holds this header, the NUL terminated
+//population names and SNP IDs, one allele per locus, a checksum for each
+//population's column and then each population's frequencies as one
+//contiguous column of doubles, so a run only pages in the column it
+//uses.  Everything before the columns is covered by metaChecksum.  It is
+//rebuilt whenever the size or modification time of the frequency file
+//changes, or it fails a check.
+struct freq_cache_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t npop;
+    uint64_t nloci;
+    int64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t popOffset;
+    uint64_t idOffset;
+    uint64_t alleleOffset;
+    uint64_t checksumOffset;
+    uint64_t freqOffset;
+    uint64_t fileSize;
+    uint64_t metaChecksum;
+};
+
+//Steps past count NUL terminated strings starting at p, returning NULL
+//if they do not all end before end
+static const char *skipCacheStrings(const char *p, const char *end, uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        const char *nul = (const char *)memchr(p, '\0', end - p);
+        if (nul == NULL) return NULL;
+        p = nul + 1;
+    }
+    return p;
+}
+
+//Returns false, leaving the frequencies untouched, if the cache is
+//missing, stale or damaged
+static bool readFreqCache(string cachefile, const struct stat &source, string popName,
+                          locus_index_t &index,
+                          vector< MapData * > *mapDataByChr,
+                          vector< FreqData * > *freqDataByChr,
+                          int &unmatched)
+{
+    int fd = open(cachefile.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(freq_cache_header_t))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    const char *base = (const char *)addr;
+    const freq_cache_header_t *header = (const freq_cache_header_t *)addr;
+    bool ok = memcmp(header->magic, FREQ_CACHE_MAGIC, 8) == 0 &&
+              header->version == FREQ_CACHE_VERSION &&
+              header->sourceSize == (int64_t)source.st_size &&
+              header->sourceTime == (int64_t)source.st_mtime &&
+              header->fileSize == size &&
+              header->npop <= size && header->nloci <= size &&
+              header->popOffset == sizeof(freq_cache_header_t) &&
+              header->popOffset <= header->idOffset &&
+              header->idOffset <= header->alleleOffset &&
+              header->alleleOffset + header->nloci <= header->checksumOffset &&
+              header->checksumOffset % sizeof(uint64_t) == 0 &&
+              header->checksumOffset + header->npop * sizeof(uint64_t) == header->freqOffset &&
+              header->freqOffset + header->npop * header->nloci * sizeof(double) == size;
+    ok = ok && cacheChecksum(base + header->popOffset, header->freqOffset - header->popOffset,
+                             CACHE_HASH_SEED) == header->metaChecksum;
+    //The name and ID tables must end inside their own sections
+    ok = ok && skipCacheStrings(base + header->popOffset, base + header->idOffset, header->npop) != NULL &&
+         skipCacheStrings(base + header->idOffset, base + header->alleleOffset, header->nloci) != NULL;
+    if (!ok)
+    {
+        munmap(addr, size);
+        return false;
+    }
+
+    int popLocation = -1;
+    const char *name = base + header->popOffset;
+    for (uint32_t i = 0; i < header->npop; i++)
+    {
+        if (popName.compare(name) == 0) popLocation = i;
+        name += strlen(name) + 1;
+    }
 
-            for (int pop = 0; pop < headerSize; pop++)
+    if (popLocation < 0) {
+        munmap(addr, size);
+        LOG.err("ERROR: Could not find", popName, false);
+        LOG.err(" in", cachefile);
+        throw 0;
+    }
+
+    const char *id = base + header->idOffset;
+    const char *allele = base + header->alleleOffset;
+    const double *freq = (const double *)(base + header->freqOffset) + (size_t)popLocation * header->nloci;
+    uint64_t colChecksum;
+    memcpy(&colChecksum, base + header->checksumOffset + popLocation * sizeof(uint64_t), sizeof(colChecksum));
+    if (cacheChecksum((const char *)freq, header->nloci * sizeof(double), CACHE_HASH_SEED) != colChecksum)
+    {
+        munmap(addr, size);
+        return false;
+    }
+
+    cout << "Reading allele frequencies from cache " << cachefile << "\n";
+
+    for (uint64_t locus = 0; locus < header->nloci; locus++)
+    {
+        size_t idLen = strlen(id);
+        if (!setLocusFreq(index, id, idLen, allele[locus], freq[locus], mapDataByChr, freqDataByChr)) unmatched++;
+        id += idLen + 1;
+    }
+
+    munmap(addr, size);
+    return true;
+}
+
+//Parses every column of the frequency file into a new cache.  The file
+//is read twice, once for the IDs and once for the frequencies, so that
+//the columns can be written straight into a mapping of the final size.
+//Returns false if the cache could not be written.
+static bool writeFreqCache(string freqfile, string cachefile, const struct stat &source)
+{
+    igzstream fin;
+    fin.open(freqfile.c_str());
+    if (fin.fail()) return false;
+
+    string header, field, line;
+    getline(fin, header);
+    stringstream ss;
+    ss.str(header);
+    ss >> field >> field;
+    string popNames;
+    uint32_t npop = 0;
+    while (ss >> field)
+    {
+        popNames += field;
+        popNames += '\0';
+        npop++;
+    }
+
+    string ids;
+    string alleles;
+    while (getline(fin, line))
+    {
+        const char *p = skipSpace(line.c_str());
+        if (*p == '\0') continue;
+        const char *id = p;
+        p = skipField(p);
+        ids.append(id, p - id);
+        ids += '\0';
+        alleles += *skipSpace(p);
+    }
+    fin.close();
+    fin.clear();
+
+    uint64_t nloci = alleles.size();
+    if (npop == 0 || nloci == 0) return false;
+
+    freq_cache_header_t head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, FREQ_CACHE_MAGIC, 8);
+    head.version = FREQ_CACHE_VERSION;
+    head.npop = npop;
+    head.nloci = nloci;
+    head.sourceSize = source.st_size;
+    head.sourceTime = source.st_mtime;
+    head.popOffset = sizeof(head);
+    head.idOffset = head.popOffset + popNames.size();
+    head.alleleOffset = head.idOffset + ids.size();
+    head.checksumOffset = (head.alleleOffset + nloci + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+    head.freqOffset = head.checksumOffset + npop * sizeof(uint64_t);
+    head.fileSize = head.freqOffset + npop * nloci * sizeof(double);
+
+    string tmpfile = cacheTmpFile(cachefile);
+    int fd = open(tmpfile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, head.fileSize) != 0)
+    {
+        close(fd);
+        unlink(tmpfile.c_str());
+        return false;
+    }
+    void *addr = mmap(NULL, head.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        unlink(tmpfile.c_str());
+        return false;
+    }
+
+    cout << "Writing allele frequency cache " << cachefile << "\n";
+
+    char *base = (char *)addr;
+    memcpy(base + head.popOffset, popNames.data(), popNames.size());
+    memcpy(base + head.idOffset, ids.data(), ids.size());
+    memcpy(base + head.alleleOffset, alleles.data(), nloci);
+    double *freq = (double *)(base + head.freqOffset);
+
+    bool ok = true;
+    fin.open(freqfile.c_str());
+    getline(fin, header);
+    uint64_t locus = 0;
+    while (ok && getline(fin, line))
+    {
+        const char *p = skipSpace(line.c_str());
+        if (*p == '\0') continue;
+        if (locus >= nloci)
+        {
+            ok = false;
+            break;
+        }
+        p = skipField(skipSpace(skipField(p)));
+        for (uint32_t pop = 0; pop < npop && ok; pop++)
+        {
+            p = skipSpace(p);
+            if (*p == '\0' || !parseFreqValue(p, freq[pop * nloci + locus])) ok = false;
+        }
+        locus++;
+    }
+    fin.close();
+    ok = ok && (locus == nloci);
+
+    //The header goes in last, once the checksums cover everything
+    if (ok)
+    {
+        for (uint32_t pop = 0; pop < npop; pop++)
+        {
+            uint64_t colChecksum = cacheChecksum((const char *)(freq + pop * nloci), nloci * sizeof(double),
+                                                 CACHE_HASH_SEED);
+            memcpy(base + head.checksumOffset + pop * sizeof(uint64_t), &colChecksum, sizeof(colChecksum));
+        }
+        head.metaChecksum = cacheChecksum(base + head.popOffset, head.freqOffset - head.popOffset, CACHE_HASH_SEED);
+        memcpy(base, &head, sizeof(head));
+    }
+
+    munmap(addr, head.fileSize);
+    if (!ok || rename(tmpfile.c_str(), cachefile.c_str()) != 0)
+    {
+        unlink(tmpfile.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif
+
+//Frequencies are matched to the map by SNP ID, so the file may list the
+//loci in any order and hold loci absent from the genotype data.  Loci
+//missing from the file keep a MISSING frequency and are dropped with the
+//monomorphic sites.
+vector< FreqData * > *readFreqData(string freqfile, string popName,
+                                   vector< int_pair_t > *chrCoordList,
+                                   vector< MapData * > *mapDataByChr,
+                                   bool useCache)
+{
+    vector< FreqData * > *freqDataByChr = new vector< FreqData * >;
+    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
+    {
+        FreqData *data = initFreqData(mapDataByChr->at(chr)->nloci);
+        freqDataByChr->push_back(data);
+    }
+
+    locus_index_t index;
+    initLocusIndex(index, mapDataByChr);
+
+    int unmatched = 0;
+    bool loaded = false;
+    if (useCache)
+    {
+#ifndef _WIN32
+        string cachefile = freqfile + ".cache";
+        struct stat source;
+        if (stat(freqfile.c_str(), &source) != 0 || !S_ISREG(source.st_mode))
+        {
+            LOG.err("WARNING: Frequency cache requires a regular file:", freqfile);
+        }
+        else
+        {
+            loaded = readFreqCache(cachefile, source, popName, index, mapDataByChr, freqDataByChr, unmatched);
+            if (!loaded)
             {
-                fin >> freq;
-                if (pop == popLocation)
+                if (writeFreqCache(freqfile, cachefile, source))
+                {
+                    loaded = readFreqCache(cachefile, source, popName, index, mapDataByChr, freqDataByChr, unmatched);
+                }
+                else
                 {
-                    freqDataByChr->at(chr)->freq[locus] = freq;
+                    LOG.err("WARNING: Could not write frequency cache", cachefile);
                 }
             }
         }
+#else
+        LOG.err("WARNING: Frequency caches are not supported on this platform.");
+#endif
     }
 
-    fin.close();
+    if (!loaded) readFreqText(freqfile, popName, index, mapDataByChr, freqDataByChr, unmatched);
+
+    int missing = index.name.size() - index.nset;
+    if (unmatched > 0) LOG.log("Frequency file loci not in genotype data:", unmatched);
+    if (missing > 0)
+    {
+        LOG.err("WARNING: Loci without a frequency, dropped from analysis:", missing);
+    }
 
     return freqDataByChr;
 }
@@ -642,28 +1049,742 @@ vector< vector< HapData * >* > *readTPEDHapData(string filename,
                              << locus + 1 << locPost << " locus on the "
                              << chr + 1 << chrPost << " chromosome has an illegal value.\n";
 
-                        throw 0;
-                    }
-                    hapDataByPopByChr->at(pop)->at(chr)->data[hap][locus] = allele;
-                }
-            }
+                        throw 0;
+                    }
+                    hapDataByPopByChr->at(pop)->at(chr)->data[hap][locus] = allele;
+                }
+            }
+        }
+    }
+    fin.close();
+
+    return hapDataByPopByChr;
+}
+*/
+
+/*
+vector< HapData * > *readTPEDHapData3(string filename,
+                                      int expectedLoci,
+                                      int expectedInd,
+                                      char TPED_MISSING,
+                                      vector< MapData * > *mapDataByChr)
+{
+    int expectedHaps = 2 * expectedInd;
+    igzstream fin;
+    //cerr << "Checking " << filename << "...\n";
+    fin.open(filename.c_str());
+
+    if (fin.fail())
+    {
+        cerr << "ERROR: Failed to open " << filename << " for reading.\n";
+        LOG.err("ERROR: Failed to open", filename);
+        throw 0;
+    }
+
+    cout << "Loading genotypes from " << filename << "\n";
+
+    //int fileStart = fin.tellg();
+    string line;
+    int nhaps = -1;
+    int nloci = 0;
+    while (getline(fin, line))
+    {
+        nloci++;
+        nhaps = countFields(line);
+        //cout << "nhaps: " << current_nhaps << endl;
+        if (nhaps != expectedHaps + 4)
+        {
+            cerr << "ERROR: line " << nloci << " of " << filename << " has " << nhaps
+                 << " columns, but expected " << expectedHaps + 4 << ".\n";
+            LOG.err("ERROR: line", nloci, false);
+            LOG.err(" of", filename, false);
+            LOG.err(" has", nhaps, false);
+            LOG.err(" columns, but expected", expectedHaps);
+            throw 0;
+        }
+    }
+    if (nloci != expectedLoci)
+    {
+        cerr << "ERROR: " << filename << " has " << nloci
+             << " loci, but expected " << expectedLoci << ".\n";
+        LOG.err("ERROR:", filename, false);
+        LOG.err(" has", nloci, false);
+        LOG.err(" loci, but expected", expectedLoci);
+        throw 0;
+    }
+
+    fin.close();
+    fin.clear();
+
+    fin.open(filename.c_str());
+
+    if (fin.fail())
+    {
+        cerr << "ERROR: Failed to open " << filename << " for reading.\n";
+        LOG.err("ERROR: Failed to open", filename);
+        throw 0;
+    }
+
+    vector< HapData * > *hapDataByChr = new vector< HapData * >;
+    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
+    {
+        HapData *data = initHapData(expectedInd, mapDataByChr->at(chr)->nloci);
+        hapDataByChr->push_back(data);
+    }
+
+    //string alleleStr1, alleleStr2;
+    char alleleStr1, alleleStr2;
+    string junk;//, oneAllele;
+    char oneAllele;
+    short allele;
+    //For each chromosome
+    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
+    {
+        //For each locus on the chromosome
+        for (int locus = 0; locus < mapDataByChr->at(chr)->nloci; locus++)
+        {
+            oneAllele = mapDataByChr->at(chr)->allele[locus];
+            fin >> junk;
+            fin >> junk;
+            fin >> junk;
+            fin >> junk;
+            for (int ind = 0; ind < expectedInd; ind++)
+            {
+                fin >> alleleStr1 >> alleleStr2;
+                allele = 0;
+
+                if (alleleStr1 == TPED_MISSING) allele += -9;
+                else if (alleleStr1 == oneAllele) allele += 1;
+
+                if (alleleStr2 == TPED_MISSING) allele += -9;
+                else if (alleleStr2 == oneAllele) allele += 1;
+
+                setGenotype(hapDataByChr->at(chr), locus, ind, allele);
+            }
+        }
+    }
+
+    fin.close();
+    return hapDataByChr;
+}
+*/
+
+//Allocates a 64 byte aligned block of packed genotype words, or
+//returns NULL if there is not enough memory.
+static uint64_t *allocGenoBlock(size_t nwords)
+{
+#ifdef _WIN32
+    void *block = _aligned_malloc(nwords * sizeof(uint64_t), 64);
+#else
+    void *block = NULL;
+    if (posix_memalign(&block, 64, nwords * sizeof(uint64_t)) != 0) block = NULL;
+#endif
+    return (uint64_t *)block;
+}
+
+static void freeGenoBlock(uint64_t *block)
+{
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+    return;
+}
+
+//Packed rows buffered by the loaders for the chromosome being read.
+//The block is handed to the chromosome's HapData as is when it is
+//flushed, so the genotypes are never copied a second time.  The
+//destructor frees a block still held when a parse error throws.
+struct geno_buffer_t
+{
+    uint64_t *data;
+    size_t nwords;
+    size_t capacity;
+
+    geno_buffer_t() : data(NULL), nwords(0), capacity(0) {}
+    ~geno_buffer_t() { freeGenoBlock(data); }
+};
+
+//Grows buffer to hold at least capacity words
+static void reserveGenoBuffer(geno_buffer_t &buffer, size_t capacity, int nind)
+{
+    if (capacity <= buffer.capacity) return;
+    uint64_t *block = allocGenoBlock(capacity);
+    if (block == NULL)
+    {
+        cerr << "ERROR: Can not allocate genotypes for " << nind << " individuals at "
+             << capacity / hapWordsPerLocus(nind) << " loci.\n";
+        LOG.err("ERROR: Can not allocate genotypes for", nind, false);
+        LOG.err(" individuals at", int(capacity / hapWordsPerLocus(nind)), false);
+        LOG.err(" loci.");
+        throw 0;
+    }
+    if (buffer.nwords > 0) memcpy(block, buffer.data, buffer.nwords * sizeof(uint64_t));
+    freeGenoBlock(buffer.data);
+    buffer.data = block;
+    buffer.capacity = capacity;
+    return;
+}
+
+//Appends nwords packed words to buffer, growing it by half again when full
+static void appendGenoBuffer(geno_buffer_t &buffer, const uint64_t *words, size_t nwords, int nind)
+{
+    if (buffer.nwords + nwords > buffer.capacity)
+    {
+        size_t capacity = buffer.capacity + buffer.capacity / 2;
+        if (capacity < buffer.nwords + nwords) capacity = buffer.nwords + nwords;
+        if (capacity < 1024) capacity = 1024;
+        reserveGenoBuffer(buffer, capacity, nind);
+    }
+    memcpy(buffer.data + buffer.nwords, words, nwords * sizeof(uint64_t));
+    buffer.nwords += nwords;
+    return;
+}
+
+//Moves the loci buffered for a single chromosome into new MapData
+//and HapData objects.  genotypes holds the packed rows of each locus
+//back to back, and alleleCount/calledCount their tallies.  The
+//HapData takes over the genotype block, leaving genotypes empty.
+static void flushChrData(string chr,
+                         vector< string > &locusName,
+                         vector< double > &geneticPos,
+                         vector< int > &physicalPos,
+                         vector< char > &allele,
+                         geno_buffer_t &genotypes,
+                         vector< int > &alleleCount,
+                         vector< int > &calledCount,
+                         int nind,
+                         vector< MapData * > *mapDataByChr,
+                         vector< HapData * > *hapDataByChr)
+{
+    int nloci = allele.size();
+    MapData *mapData = initMapData(nloci);
+    for (int locus = 0; locus < nloci; locus++)
+    {
+        mapData->locusName[locus] = locusName[locus];
+        mapData->geneticPos[locus] = geneticPos[locus];
+        mapData->physicalPos[locus] = physicalPos[locus];
+        mapData->allele[locus] = allele[locus];
+    }
+    mapData->chr = lc(chr);
+    mapData->chr = checkChrName(mapData->chr);
+
+    HapData *hapData = new HapData;
+    hapData->nind = nind;
+    hapData->nloci = nloci;
+    hapData->wordsPerLocus = hapWordsPerLocus(nind);
+    hapData->data = genotypes.data;
+    hapData->mappedBytes = 0;
+    genotypes.data = NULL;
+    genotypes.nwords = 0;
+    genotypes.capacity = 0;
+    initHapCounts(hapData);
+    memcpy(hapData->alleleCount, &(alleleCount[0]), nloci * sizeof(int));
+    memcpy(hapData->calledCount, &(calledCount[0]), nloci * sizeof(int));
+
+    cout << nloci << " loci on chromosome " << mapData->chr << endl;
+
+    mapDataByChr->push_back(mapData);
+    hapDataByChr->push_back(hapData);
+
+    locusName.clear();
+    geneticPos.clear();
+    physicalPos.clear();
+    allele.clear();
+    alleleCount.clear();
+    calledCount.clear();
+    return;
+}
+
+//Parses the map columns and genotypes of one TPED line.  tok/tokLen
+//receive the four map columns and the packed row the genotypes, coded
+//against the first non-missing allele seen, which is returned in
+//oneAllele.  Only the first character of each allele is used.  Returns
+//the number of columns on the line.
+static int parseTPEDLine(const char *p, const char *end, int nind, char TPED_MISSING,
+                         const char **tok, int *tokLen, uint64_t *row, char &oneAllele)
+{
+    int nwords = hapWordsPerLocus(nind);
+    for (int w = 0; w < nwords; w++) row[w] = HAP_MISSING_WORD;
+
+    int ncols = 0;
+
+    //The four map columns
+    while (ncols < 4)
+    {
+        while (p < end && isspace(*p)) p++;
+        if (p >= end) return ncols;
+        tok[ncols] = p;
+        while (p < end && !isspace(*p)) p++;
+        tokLen[ncols] = p - tok[ncols];
+        ncols++;
+    }
+
+    oneAllele = TPED_MISSING;
+    char a1 = TPED_MISSING, a2;
+    int ind = 0;
+    int nalleles = 0;
+    while (true)
+    {
+        while (p < end && isspace(*p)) p++;
+        if (p >= end) break;
+        if (nalleles < 2 * nind)
+        {
+            //Half missing genotypes stay missing, but still supply
+            //oneAllele if they come first
+            if (oneAllele == TPED_MISSING) oneAllele = *p;
+            if (nalleles % 2 == 0) a1 = *p;
+            else
+            {
+                a2 = *p;
+                if (a1 != TPED_MISSING && a2 != TPED_MISSING)
+                {
+                    setGenotype(row, ind, (a1 == oneAllele) + (a2 == oneAllele));
+                }
+                ind++;
+            }
+        }
+        nalleles++;
+        while (p < end && !isspace(*p)) p++;
+    }
+
+    return ncols + nalleles;
+}
+
+static void tpedColumnError(string filename, int line, int ncols, int expectedCols)
+{
+    cerr << "ERROR: line " << line << " of " << filename << " has " << ncols
+         << " columns, but expected " << expectedCols << ".\n";
+    LOG.err("ERROR: line", line, false);
+    LOG.err(" of", filename, false);
+    LOG.err(" has", ncols, false);
+    LOG.err(" columns, but expected", expectedCols);
+    return;
+}
+
+static void noDataError(string locus)
+{
+    cerr << "ERROR: locus " << locus << " appears to have no data.\n";
+    LOG.err("ERROR: Locus appears to have no data:", locus);
+    return;
+}
+
+#ifndef _WIN32
+
+//The loci parsed by one thread from a line-aligned range of a mapped
+//TPED file
+struct tped_chunk_t
+{
+    const char *start;
+    const char *end;
+    int nind;
+    int expectedCols;
+    char TPED_MISSING;
+
+    //Chromosome names and the first locus of each run of loci
+    vector< string > chr;
+    vector< int > chrStart;
+
+    vector< string > locusName;
+    vector< double > geneticPos;
+    vector< int > physicalPos;
+    vector< char > allele;
+    vector< uint64_t > genotypes;
+    vector< int > alleleCount;
+    vector< int > calledCount;
+
+    //Lines consumed, and the column count of a bad line if any
+    int nlines;
+    int errCols;
+    bool noData;
+};
+
+static void *parseTPEDChunk(void *arg)
+{
+    tped_chunk_t *chunk = (tped_chunk_t *)arg;
+    const char *tok[4];
+    int tokLen[4];
+    const char *p = chunk->start;
+    int nwords = hapWordsPerLocus(chunk->nind);
+    uint64_t *row = new uint64_t[nwords];
+    chunk->nlines = 0;
+    chunk->errCols = -1;
+    chunk->noData = false;
+
+    while (p < chunk->end)
+    {
+        const char *eol = (const char *)memchr(p, '\n', chunk->end - p);
+        if (eol == NULL) eol = chunk->end;
+        chunk->nlines++;
+
+        char oneAllele;
+        int ncols = parseTPEDLine(p, eol, chunk->nind, chunk->TPED_MISSING, tok, tokLen, row, oneAllele);
+        if (ncols != chunk->expectedCols)
+        {
+            chunk->errCols = ncols;
+            break;
+        }
+
+        chunk->locusName.push_back(string(tok[1], tokLen[1]));
+        if (oneAllele == chunk->TPED_MISSING)
+        {
+            chunk->noData = true;
+            break;
+        }
+
+        if (chunk->chr.empty() || chunk->chr.back().compare(0, string::npos, tok[0], tokLen[0]) != 0)
+        {
+            chunk->chr.push_back(string(tok[0], tokLen[0]));
+            chunk->chrStart.push_back(chunk->allele.size());
+        }
+        chunk->geneticPos.push_back(strtod(tok[2], NULL));
+        chunk->physicalPos.push_back(atoi(tok[3]));
+        chunk->allele.push_back(oneAllele);
+        chunk->genotypes.insert(chunk->genotypes.end(), row, row + nwords);
+        int alleles, called;
+        countHapRow(row, nwords, chunk->nind, alleles, called);
+        chunk->alleleCount.push_back(alleles);
+        chunk->calledCount.push_back(called);
+
+        p = eol + 1;
+    }
+    delete [] row;
+    return NULL;
+}
+
+//True if filename is a regular, uncompressed file that can be mapped
+static bool isMappableText(string filename)
+{
+    if (filename.compare("-") == 0) return false;
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL) return false;
+    unsigned char magic[2] = {0, 0};
+    int n = fread(magic, 1, 2, fp);
+    fclose(fp);
+    return !(n == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+}
+
+//Maps an uncompressed TPED file and parses line-aligned ranges of it on
+//numThreads threads.  The per-thread results are then stitched together
+//in file order into per-chromosome MapData/HapData.
+static void readTPEDDataMapped(string filename,
+                               int expectedInd,
+                               char TPED_MISSING,
+                               int numThreads,
+                               vector< MapData * > **mapDataByChr,
+                               vector< HapData * > **hapDataByChr,
+                               vector< int_pair_t > **chrCoordList,
+                               int &numLoci)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0) close(fd);
+        cerr << "ERROR: Failed to open " << filename << " for reading.\n";
+        LOG.err("ERROR: Failed to open", filename);
+        throw 0;
+    }
+
+    cout << "Loading map and genotypes from " << filename << " with " << numThreads << " threads\n";
+
+    size_t size = st.st_size;
+    const char *text = NULL;
+    if (size > 0)
+    {
+        void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            close(fd);
+            cerr << "ERROR: Failed to map " << filename << " into memory.\n";
+            LOG.err("ERROR: Failed to map into memory", filename);
+            throw 0;
+        }
+        madvise(addr, size, MADV_SEQUENTIAL);
+        text = (const char *)addr;
+    }
+
+    //Split at line boundaries
+    const char *fileEnd = text + size;
+    tped_chunk_t *chunks = new tped_chunk_t[numThreads];
+    const char *p = text;
+    for (int i = 0; i < numThreads; i++)
+    {
+        const char *q = (i == numThreads - 1) ? fileEnd : text + (size / numThreads) * (i + 1);
+        if (q < p) q = p;
+        if (q < fileEnd)
+        {
+            q = (const char *)memchr(q, '\n', fileEnd - q);
+            q = (q == NULL) ? fileEnd : q + 1;
+        }
+        chunks[i].start = p;
+        chunks[i].end = q;
+        chunks[i].nind = expectedInd;
+        chunks[i].expectedCols = 2 * expectedInd + 4;
+        chunks[i].TPED_MISSING = TPED_MISSING;
+        p = q;
+    }
+
+    pthread_t *peer = new pthread_t[numThreads];
+    for (int i = 0; i < numThreads; i++) pthread_create(&(peer[i]), NULL, parseTPEDChunk, (void *)&(chunks[i]));
+    for (int i = 0; i < numThreads; i++) pthread_join(peer[i], NULL);
+    delete [] peer;
+
+    if (text != NULL) munmap((void *)text, size);
+    close(fd);
+
+    //Report the first bad line in file order
+    int nlines = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        nlines += chunks[i].nlines;
+        if (chunks[i].errCols >= 0)
+        {
+            tpedColumnError(filename, nlines, chunks[i].errCols, 2 * expectedInd + 4);
+            throw 0;
+        }
+        if (chunks[i].noData)
+        {
+            noDataError(chunks[i].locusName.back());
+            throw 0;
+        }
+    }
+
+    if (nlines == 0)
+    {
+        cerr << "ERROR: " << filename << " contains no loci.\n";
+        LOG.err("ERROR: No loci found in", filename);
+        throw 0;
+    }
+
+    vector< MapData * > *newMapDataByChr = new vector< MapData * >;
+    vector< HapData * > *newHapDataByChr = new vector< HapData * >;
+    vector< int_pair_t > *chrStartStop = new vector< int_pair_t >;
+
+    vector< string > locusName;
+    vector< double > geneticPos;
+    vector< int > physicalPos;
+    vector< char > allele;
+    geno_buffer_t genotypes;
+    vector< int > alleleCount;
+    vector< int > calledCount;
+
+    //Loci on each chromosome in file order, so that each genotype block
+    //is allocated once at its final size
+    vector< size_t > chrLoci;
+    string prevChr;
+    for (int i = 0; i < numThreads; i++)
+    {
+        tped_chunk_t *chunk = &(chunks[i]);
+        for (unsigned int run = 0; run < chunk->chr.size(); run++)
+        {
+            int runEnd = (run + 1 == chunk->chr.size()) ? chunk->allele.size() : chunk->chrStart[run + 1];
+            if (chrLoci.size() == 0 || chunk->chr[run].compare(prevChr) != 0)
+            {
+                chrLoci.push_back(0);
+                prevChr = chunk->chr[run];
+            }
+            chrLoci.back() += runEnd - chunk->chrStart[run];
+        }
+    }
+
+    int nwords = hapWordsPerLocus(expectedInd);
+    int_pair_t currChrCoordinates;
+    int nloci = 0;
+    int nchr = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        tped_chunk_t *chunk = &(chunks[i]);
+        for (unsigned int run = 0; run < chunk->chr.size(); run++)
+        {
+            if (nloci == 0)
+            {
+                prevChr = chunk->chr[run];
+                currChrCoordinates.first = 0;
+                reserveGenoBuffer(genotypes, chrLoci[nchr++] * nwords, expectedInd);
+            }
+            else if (chunk->chr[run].compare(prevChr) != 0)
+            {
+                currChrCoordinates.second = nloci - 1;
+                chrStartStop->push_back(currChrCoordinates);
+                currChrCoordinates.first = nloci;
+                flushChrData(prevChr, locusName, geneticPos, physicalPos, allele, genotypes,
+                             alleleCount, calledCount, expectedInd, newMapDataByChr, newHapDataByChr);
+                prevChr = chunk->chr[run];
+                reserveGenoBuffer(genotypes, chrLoci[nchr++] * nwords, expectedInd);
+            }
+
+            int runEnd = (run + 1 == chunk->chr.size()) ? chunk->allele.size() : chunk->chrStart[run + 1];
+            for (int locus = chunk->chrStart[run]; locus < runEnd; locus++)
+            {
+                locusName.push_back(chunk->locusName[locus]);
+                geneticPos.push_back(chunk->geneticPos[locus]);
+                physicalPos.push_back(chunk->physicalPos[locus]);
+                allele.push_back(chunk->allele[locus]);
+                alleleCount.push_back(chunk->alleleCount[locus]);
+                calledCount.push_back(chunk->calledCount[locus]);
+                nloci++;
+            }
+            appendGenoBuffer(genotypes, &(chunk->genotypes[(size_t)chunk->chrStart[run] * nwords]),
+                             (size_t)(runEnd - chunk->chrStart[run]) * nwords, expectedInd);
+        }
+
+        //Release the chunk's copy of its loci now that they are merged
+        vector< uint64_t >().swap(chunk->genotypes);
+        vector< string >().swap(chunk->locusName);
+        vector< double >().swap(chunk->geneticPos);
+        vector< int >().swap(chunk->physicalPos);
+        vector< char >().swap(chunk->allele);
+        vector< int >().swap(chunk->alleleCount);
+        vector< int >().swap(chunk->calledCount);
+    }
+    delete [] chunks;
+
+    currChrCoordinates.second = nloci - 1;
+    chrStartStop->push_back(currChrCoordinates);
+    flushChrData(prevChr, locusName, geneticPos, physicalPos, allele, genotypes,
+                 alleleCount, calledCount, expectedInd, newMapDataByChr, newHapDataByChr);
+
+    numLoci = nloci;
+    *mapDataByChr = newMapDataByChr;
+    *hapDataByChr = newHapDataByChr;
+    *chrCoordList = chrStartStop;
+    return;
+}
+
+#endif
+
+//Reads map and genotype information from a TPED file in a single pass.
+//Loci are buffered one chromosome at a time, so the file is never
+//rewound and may be a pipe or "-" for stdin.  Uncompressed regular
+//files are memory mapped and parsed in parallel when numThreads > 1.
+void readTPEDData(string filename,
+                  int expectedInd,
+                  char TPED_MISSING,
+                  int numThreads,
+                  vector< MapData * > **mapDataByChr,
+                  vector< HapData * > **hapDataByChr,
+                  vector< int_pair_t > **chrCoordList,
+                  int &numLoci)
+{
+#ifndef _WIN32
+    if (numThreads > 1 && isMappableText(filename))
+    {
+        readTPEDDataMapped(filename, expectedInd, TPED_MISSING, numThreads,
+                           mapDataByChr, hapDataByChr, chrCoordList, numLoci);
+        return;
+    }
+#endif
+
+    igzstream fin;
+    fin.open(filename.c_str());
+
+    if (fin.fail())
+    {
+        cerr << "ERROR: Failed to open " << filename << " for reading.\n";
+        LOG.err("ERROR: Failed to open", filename);
+        throw 0;
+    }
+
+    cout << "Loading map and genotypes from " << filename << "\n";
+
+    int expectedCols = 2 * expectedInd + 4;
+    vector< MapData * > *newMapDataByChr = new vector< MapData * >;
+    vector< HapData * > *newHapDataByChr = new vector< HapData * >;
+    vector< int_pair_t > *chrStartStop = new vector< int_pair_t >;
+
+    vector< string > locusName;
+    vector< double > geneticPos;
+    vector< int > physicalPos;
+    vector< char > allele;
+    geno_buffer_t genotypes;
+    vector< int > alleleCount;
+    vector< int > calledCount;
+
+    string line, currChr, prevChr;
+    int_pair_t currChrCoordinates;
+    int nloci = 0;
+    const char *tok[4];
+    int tokLen[4];
+    int nwords = hapWordsPerLocus(expectedInd);
+    uint64_t *row = new uint64_t[nwords];
+    while (getline(fin, line))
+    {
+        nloci++;
+        char oneAllele;
+        int ncols = parseTPEDLine(line.c_str(), line.c_str() + line.size(), expectedInd,
+                                  TPED_MISSING, tok, tokLen, row, oneAllele);
+        if (ncols != expectedCols)
+        {
+            delete [] row;
+            tpedColumnError(filename, nloci, ncols, expectedCols);
+            throw 0;
+        }
+
+        currChr.assign(tok[0], tokLen[0]);
+        if (nloci == 1)
+        {
+            prevChr = currChr;
+            currChrCoordinates.first = 0;
+        }
+        else if (currChr.compare(prevChr) != 0)
+        {
+            currChrCoordinates.second = nloci - 2;
+            chrStartStop->push_back(currChrCoordinates);
+            currChrCoordinates.first = nloci - 1;
+            flushChrData(prevChr, locusName, geneticPos, physicalPos, allele, genotypes,
+                         alleleCount, calledCount, expectedInd, newMapDataByChr, newHapDataByChr);
+            prevChr = currChr;
+        }
+
+        locusName.push_back(string(tok[1], tokLen[1]));
+        if (oneAllele == TPED_MISSING)
+        {
+            delete [] row;
+            noDataError(locusName.back());
+            throw 0;
         }
+
+        geneticPos.push_back(strtod(tok[2], NULL));
+        physicalPos.push_back(atoi(tok[3]));
+        allele.push_back(oneAllele);
+        appendGenoBuffer(genotypes, row, nwords, expectedInd);
+        int alleles, called;
+        countHapRow(row, nwords, expectedInd, alleles, called);
+        alleleCount.push_back(alleles);
+        calledCount.push_back(called);
     }
+
+    delete [] row;
     fin.close();
 
-    return hapDataByPopByChr;
+    if (nloci == 0)
+    {
+        cerr << "ERROR: " << filename << " contains no loci.\n";
+        LOG.err("ERROR: No loci found in", filename);
+        throw 0;
+    }
+
+    currChrCoordinates.second = nloci - 1;
+    chrStartStop->push_back(currChrCoordinates);
+    flushChrData(prevChr, locusName, geneticPos, physicalPos, allele, genotypes,
+                 alleleCount, calledCount, expectedInd, newMapDataByChr, newHapDataByChr);
+
+    numLoci = nloci;
+    *mapDataByChr = newMapDataByChr;
+    *hapDataByChr = newHapDataByChr;
+    *chrCoordList = chrStartStop;
+    return;
 }
-*/
 
-vector< HapData * > *readTPEDHapData3(string filename,
-                                      int expectedLoci,
-                                      int expectedInd,
-                                      char TPED_MISSING,
-                                      vector< MapData * > *mapDataByChr)
+//Reads locus information from a PLINK .bim file
+//The first character of the A1 allele is used as the 'one' allele
+vector< MapData * > *readBIMData(string filename, vector< int_pair_t > **chrCoordList, int &numLoci)
 {
-    int expectedHaps = 2 * expectedInd;
     igzstream fin;
-    //cerr << "Checking " << filename << "...\n";
     fin.open(filename.c_str());
 
     if (fin.fail())
@@ -673,42 +1794,95 @@ vector< HapData * > *readTPEDHapData3(string filename,
         throw 0;
     }
 
-    cout << "Loading genotypes from " << filename << "\n";
+    cout << "Loading map from " << filename << "\n";
 
-    //int fileStart = fin.tellg();
-    string line;
-    int nhaps = -1;
+    vector< string > chrName;
+    vector< string > locusName;
+    vector< double > geneticPos;
+    vector< int > physicalPos;
+    vector< char > allele;
+
+    string line, chr, locus, a1, a2;
+    double gpos;
+    int ppos;
     int nloci = 0;
+    int minCols = 6;
+    int currentCols;
+    stringstream ss;
     while (getline(fin, line))
     {
         nloci++;
-        nhaps = countFields(line);
-        //cout << "nhaps: " << current_nhaps << endl;
-        if (nhaps != expectedHaps + 4)
+        currentCols = countFields(line);
+        if (currentCols < minCols)
         {
-            cerr << "ERROR: line " << nloci << " of " << filename << " has " << nhaps
-                 << " columns, but expected " << expectedHaps + 4 << ".\n";
-            LOG.err("ERROR: line", nloci, false);
+            cerr << "ERROR: line " << nloci << " of " << filename << " has " << currentCols
+                 << ", but expected at least " << minCols << ".\n";
+            LOG.err("ERROR: Line", nloci, false);
             LOG.err(" of", filename, false);
-            LOG.err(" has", nhaps, false);
-            LOG.err(" columns, but expected", expectedHaps);
+            LOG.err(" has", currentCols, false);
+            LOG.err(", but expected at least", minCols);
             throw 0;
         }
+        ss.str(line);
+        ss >> chr >> locus >> gpos >> ppos >> a1 >> a2;
+        ss.clear();
+
+        chrName.push_back(chr);
+        locusName.push_back(locus);
+        geneticPos.push_back(gpos);
+        physicalPos.push_back(ppos);
+        allele.push_back(a1[0]);
     }
-    if (nloci != expectedLoci)
+
+    fin.close();
+
+    if (nloci == 0)
     {
-        cerr << "ERROR: " << filename << " has " << nloci
-             << " loci, but expected " << expectedLoci << ".\n";
-        LOG.err("ERROR:", filename, false);
-        LOG.err(" has", nloci, false);
-        LOG.err(" loci, but expected", expectedLoci);
+        cerr << "ERROR: " << filename << " contains no loci.\n";
+        LOG.err("ERROR: No loci found in", filename);
         throw 0;
     }
 
-    fin.close();
-    fin.clear();
+    vector< MapData * > *mapDataByChr = new vector< MapData * >;
+    vector< int_pair_t > *chrStartStop = new vector< int_pair_t >;
+    int_pair_t currChrCoordinates;
+    currChrCoordinates.first = 0;
+    for (int i = 1; i <= nloci; i++)
+    {
+        if (i < nloci && chrName[i].compare(chrName[i - 1]) == 0) continue;
 
-    fin.open(filename.c_str());
+        currChrCoordinates.second = i - 1;
+        chrStartStop->push_back(currChrCoordinates);
+
+        int size = currChrCoordinates.second - currChrCoordinates.first + 1;
+        MapData *data = initMapData(size);
+        for (int locus = 0; locus < size; locus++)
+        {
+            int index = currChrCoordinates.first + locus;
+            data->locusName[locus] = locusName[index];
+            data->geneticPos[locus] = geneticPos[index];
+            data->physicalPos[locus] = physicalPos[index];
+            data->allele[locus] = allele[index];
+        }
+        data->chr = lc(chrName[i - 1]);
+        data->chr = checkChrName(data->chr);
+        cout << size << " loci on chromosome " << data->chr << endl;
+        mapDataByChr->push_back(data);
+
+        currChrCoordinates.first = i;
+    }
+
+    numLoci = nloci;
+    *chrCoordList = chrStartStop;
+    return mapDataByChr;
+}
+
+//Reads genotypes from a SNP-major PLINK .bed file
+//Genotypes are coded as the number of A1 alleles
+vector< HapData * > *readBEDData(string filename, int expectedInd, vector< MapData * > *mapDataByChr)
+{
+    ifstream fin;
+    fin.open(filename.c_str(), ios::in | ios::binary);
 
     if (fin.fail())
     {
@@ -717,48 +1891,323 @@ vector< HapData * > *readTPEDHapData3(string filename,
         throw 0;
     }
 
+    cout << "Loading genotypes from " << filename << "\n";
+
+    unsigned char magic[3];
+    fin.read((char *)magic, 3);
+    if (fin.gcount() != 3 || magic[0] != 0x6c || magic[1] != 0x1b)
+    {
+        cerr << "ERROR: " << filename << " is not a PLINK .bed file.\n";
+        LOG.err("ERROR: Not a PLINK .bed file:", filename);
+        throw 0;
+    }
+    if (magic[2] != 0x01)
+    {
+        cerr << "ERROR: " << filename << " is not in SNP-major mode.\n";
+        LOG.err("ERROR: PLINK .bed file is not in SNP-major mode:", filename);
+        throw 0;
+    }
+
+    //Each byte holds four genotypes, lowest bits first
+    //00 hom A1, 01 missing, 10 het, 11 hom A2
+    //which are recoded a byte at a time into the HapData packing
+    const uint64_t code[4] = {2, 3, 1, 0};
+    uint64_t recode[256];
+    for (int b = 0; b < 256; b++)
+    {
+        recode[b] = 0;
+        for (int k = 0; k < 4; k++) recode[b] |= code[(b >> (2 * k)) & 3] << (2 * k);
+    }
+
+    int bytesPerLocus = (expectedInd + 3) / 4;
+    unsigned char *buffer = new unsigned char[bytesPerLocus];
+
     vector< HapData * > *hapDataByChr = new vector< HapData * >;
     for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
     {
         HapData *data = initHapData(expectedInd, mapDataByChr->at(chr)->nloci);
+        initHapCounts(data);
+        for (int locus = 0; locus < data->nloci; locus++)
+        {
+            fin.read((char *)buffer, bytesPerLocus);
+            if (fin.gcount() != bytesPerLocus)
+            {
+                cerr << "ERROR: " << filename << " ended before all loci were read.\n";
+                LOG.err("ERROR: Unexpected end of file in", filename);
+                throw 0;
+            }
+
+            uint64_t *row = getHapLocus(data, locus);
+            for (int w = 0; w < data->wordsPerLocus; w++) row[w] = 0;
+            for (int byte = 0; byte < bytesPerLocus; byte++)
+            {
+                row[byte >> 3] |= recode[buffer[byte]] << ((byte & 7) << 3);
+            }
+            if (expectedInd % 32 != 0)
+            {
+                row[data->wordsPerLocus - 1] |= HAP_MISSING_WORD << ((expectedInd % 32) << 1);
+            }
+            countHapRow(row, data->wordsPerLocus, expectedInd, data->alleleCount[locus], data->calledCount[locus]);
+        }
         hapDataByChr->push_back(data);
     }
 
-    //string alleleStr1, alleleStr2;
-    char alleleStr1, alleleStr2;
-    string junk;//, oneAllele;
-    char oneAllele;
-    short allele;
-    //For each chromosome
-    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
+    delete [] buffer;
+
+    if (fin.peek() != EOF)
     {
-        //For each locus on the chromosome
-        for (int locus = 0; locus < mapDataByChr->at(chr)->nloci; locus++)
+        cerr << "ERROR: " << filename << " has more data than expected from the .bim and .fam files.\n";
+        LOG.err("ERROR: More data than expected in", filename);
+        throw 0;
+    }
+
+    fin.close();
+    return hapDataByChr;
+}
+
+//Reads sample IDs, map information and genotypes from a VCF file in a
+//single pass.  Only the leading GT subfield of each sample is parsed;
+//QUAL, FILTER, INFO and the remaining FORMAT subfields are skipped
+//without being tokenized.  As with vcf2tped.pl, all samples are given
+//the population ID "0".
+void readVCFData(string filename,
+                 IndData **indData,
+                 vector< MapData * > **mapDataByChr,
+                 vector< HapData * > **hapDataByChr,
+                 vector< int_pair_t > **chrCoordList,
+                 int &numLoci)
+{
+    igzstream fin;
+    fin.open(filename.c_str());
+
+    if (fin.fail())
+    {
+        cerr << "ERROR: Failed to open " << filename << " for reading.\n";
+        LOG.err("ERROR: Failed to open", filename);
+        throw 0;
+    }
+
+    cout << "Loading map and genotypes from " << filename << "\n";
+
+    string line;
+    int nind = 0;
+    int nlines = 0;
+    IndData *newIndData = NULL;
+    while (getline(fin, line))
+    {
+        nlines++;
+        if (line.compare(0, 2, "##") == 0) continue;
+        if (line.compare(0, 6, "#CHROM") != 0)
         {
-            oneAllele = mapDataByChr->at(chr)->allele[locus];
-            fin >> junk;
-            fin >> junk;
-            fin >> junk;
-            fin >> junk;
-            for (int ind = 0; ind < expectedInd; ind++)
+            cerr << "ERROR: " << filename << " has no #CHROM header line.\n";
+            LOG.err("ERROR: No #CHROM header line found in", filename);
+            throw 0;
+        }
+
+        nind = countFields(line) - 9;
+        newIndData = initIndData(nind);
+        newIndData->pop = "0";
+
+        map<string, int> indList;
+        stringstream ss;
+        string junk;
+        ss.str(line);
+        for (int i = 0; i < 9; i++) ss >> junk;
+        for (int ind = 0; ind < nind; ind++)
+        {
+            ss >> newIndData->indID[ind];
+            if (indList.count(newIndData->indID[ind]) > 0)
             {
-                fin >> alleleStr1 >> alleleStr2;
-                allele = 0;
+                cerr << "ERROR: Found duplicate individual ID (" << newIndData->indID[ind] << ") in " << filename << endl;
+                LOG.err("ERROR: Found duplicate individual ID ( ", newIndData->indID[ind], false);
+                LOG.err(" ) in", filename);
+                throw 0;
+            }
+            else indList[newIndData->indID[ind]] = 1;
+        }
+        break;
+    }
 
-                if (alleleStr1 == TPED_MISSING) allele += -9;
-                else if (alleleStr1 == oneAllele) allele += 1;
+    if (newIndData == NULL)
+    {
+        cerr << "ERROR: " << filename << " has no #CHROM header line.\n";
+        LOG.err("ERROR: No #CHROM header line found in", filename);
+        throw 0;
+    }
 
-                if (alleleStr2 == TPED_MISSING) allele += -9;
-                else if (alleleStr2 == oneAllele) allele += 1;
+    vector< MapData * > *newMapDataByChr = new vector< MapData * >;
+    vector< HapData * > *newHapDataByChr = new vector< HapData * >;
+    vector< int_pair_t > *chrStartStop = new vector< int_pair_t >;
+
+    vector< string > locusName;
+    vector< double > geneticPos;
+    vector< int > physicalPos;
+    vector< char > allele;
+    geno_buffer_t genotypes;
+    vector< int > alleleCount;
+    vector< int > calledCount;
+
+    string currChr, prevChr;
+    int nwords = hapWordsPerLocus(nind);
+    uint64_t *row = new uint64_t[nwords];
+    int_pair_t currChrCoordinates;
+    int nloci = 0;
+    while (getline(fin, line))
+    {
+        nlines++;
+        if (line.size() == 0) continue;
+        nloci++;
+
+        //CHROM POS ID REF ALT QUAL FILTER INFO FORMAT
+        const char *p = line.c_str();
+        const char *end = p + line.size();
+        const char *tok[9];
+        int tokLen[9];
+        int ncols = 0;
+        while (ncols < 9 && p < end)
+        {
+            tok[ncols] = p;
+            const char *tab = (const char *)memchr(p, '\t', end - p);
+            if (tab == NULL) tab = end;
+            tokLen[ncols] = tab - p;
+            ncols++;
+            p = (tab < end) ? tab + 1 : end;
+        }
+
+        if (ncols < 9 || tokLen[8] < 2 || tok[8][0] != 'G' || tok[8][1] != 'T')
+        {
+            cerr << "ERROR: line " << nlines << " of " << filename
+                 << " does not have a leading GT field in its FORMAT column.\n";
+            LOG.err("ERROR: No leading GT FORMAT field on line", nlines, false);
+            LOG.err(" of", filename);
+            delete [] row;
+            throw 0;
+        }
+
+        currChr.assign(tok[0], tokLen[0]);
+        if (nloci == 1)
+        {
+            prevChr = currChr;
+            currChrCoordinates.first = 0;
+        }
+        else if (currChr.compare(prevChr) != 0)
+        {
+            currChrCoordinates.second = nloci - 2;
+            chrStartStop->push_back(currChrCoordinates);
+            currChrCoordinates.first = nloci - 1;
+            flushChrData(prevChr, locusName, geneticPos, physicalPos, allele, genotypes,
+                         alleleCount, calledCount, nind, newMapDataByChr, newHapDataByChr);
+            prevChr = currChr;
+        }
+
+        //The counted allele is the first one observed, including in
+        //half missing calls, as when the genotypes are converted to
+        //TPED and read back
+        for (int w = 0; w < nwords; w++) row[w] = HAP_MISSING_WORD;
+        int oneAllele = -1;
+        int ind = 0;
+        while (p < end && ind < nind)
+        {
+            const char *field = p;
+            const char *tab = (const char *)memchr(p, '\t', end - p);
+            if (tab == NULL) tab = end;
+            p = (tab < end) ? tab + 1 : end;
+
+            int a[2] = { -1, -1};
+            int na = 0;
+            const char *q = field;
+            while (q < tab && *q != ':' && na < 2)
+            {
+                if (isdigit(*q))
+                {
+                    int val = 0;
+                    while (q < tab && isdigit(*q)) val = 10 * val + (*q++ - '0');
+                    a[na++] = val;
+                }
+                else if (*q == '.')
+                {
+                    a[na++] = -1;
+                    q++;
+                }
+                else if (*q == '/' || *q == '|') q++;
+                else break;
+            }
+
+            //Haploid calls are treated as missing
+            if (na == 2 && oneAllele < 0) oneAllele = (a[0] >= 0) ? a[0] : a[1];
+            if (na == 2 && a[0] >= 0 && a[1] >= 0)
+            {
+                setGenotype(row, ind, (a[0] == oneAllele) + (a[1] == oneAllele));
+            }
+            ind++;
+        }
+
+        if (ind != nind || p < end)
+        {
+            delete [] row;
+            cerr << "ERROR: line " << nlines << " of " << filename << " does not have "
+                 << nind << " samples.\n";
+            LOG.err("ERROR: Wrong number of samples on line", nlines, false);
+            LOG.err(" of", filename);
+            throw 0;
+        }
+
+        int pos = atoi(tok[1]);
+        if (tokLen[2] == 1 && tok[2][0] == '.') locusName.push_back(currChr + ":" + string(tok[1], tokLen[1]));
+        else locusName.push_back(string(tok[2], tokLen[2]));
+        if (oneAllele < 0)
+        {
+            delete [] row;
+            noDataError(locusName.back());
+            throw 0;
+        }
 
-                if (allele < 0) hapDataByChr->at(chr)->data[locus][ind] = -9;
-                else hapDataByChr->at(chr)->data[locus][ind] = allele;
+        //First character of REF or the matching ALT allele
+        char oneChar = '0';
+        if (oneAllele == 0) oneChar = tok[3][0];
+        else
+        {
+            const char *alt = tok[4];
+            const char *altEnd = tok[4] + tokLen[4];
+            for (int i = 1; i < oneAllele && alt < altEnd; i++)
+            {
+                alt = (const char *)memchr(alt, ',', altEnd - alt);
+                alt = (alt == NULL) ? altEnd : alt + 1;
             }
+            if (alt < altEnd) oneChar = *alt;
         }
+
+        geneticPos.push_back(0);
+        physicalPos.push_back(pos);
+        allele.push_back(oneChar);
+        appendGenoBuffer(genotypes, row, nwords, nind);
+        int alleles, called;
+        countHapRow(row, nwords, nind, alleles, called);
+        alleleCount.push_back(alleles);
+        calledCount.push_back(called);
     }
 
+    delete [] row;
     fin.close();
-    return hapDataByChr;
+
+    if (nloci == 0)
+    {
+        cerr << "ERROR: " << filename << " contains no loci.\n";
+        LOG.err("ERROR: No loci found in", filename);
+        throw 0;
+    }
+
+    currChrCoordinates.second = nloci - 1;
+    chrStartStop->push_back(currChrCoordinates);
+    flushChrData(prevChr, locusName, geneticPos, physicalPos, allele, genotypes,
+                 alleleCount, calledCount, nind, newMapDataByChr, newHapDataByChr);
+
+    numLoci = nloci;
+    *indData = newIndData;
+    *mapDataByChr = newMapDataByChr;
+    *hapDataByChr = newHapDataByChr;
+    *chrCoordList = chrStartStop;
+    return;
 }
 
 /*
@@ -1019,29 +2468,46 @@ HapData *initHapData(unsigned int nind, unsigned int nloci)
     HapData *data = new HapData;
     data->nind = nind;
     data->nloci = nloci;
+    data->wordsPerLocus = hapWordsPerLocus(nind);
 
-    data->data = new short*[nloci];
-    for (unsigned int i = 0; i < nloci; i++)
+    size_t nwords = (size_t)nloci * data->wordsPerLocus;
+    uint64_t *block = allocGenoBlock(nwords);
+    if (block == NULL)
     {
-        data->data[i] = new short[nind];
-        for (unsigned int j = 0; j < nind; j++)
-        {
-            data->data[i][j] = MISSING;
-        }
+        cerr << "ERROR: Can not allocate genotypes for " << nind << " individuals at "
+             << nloci << " loci.\n";
+        LOG.err("ERROR: Can not allocate genotypes for", int(nind), false);
+        LOG.err(" individuals at", int(nloci), false);
+        LOG.err(" loci.");
+        throw 0;
     }
+    data->data = block;
+    for (size_t i = 0; i < nwords; i++) data->data[i] = HAP_MISSING_WORD;
+    data->alleleCount = NULL;
+    data->calledCount = NULL;
+    data->mappedBytes = 0;
 
     return data;
 }
 
+void initHapCounts(HapData *data)
+{
+    data->alleleCount = new int[data->nloci];
+    data->calledCount = new int[data->nloci];
+    return;
+}
+
 void releaseHapData(HapData *data)
 {
     if (data == NULL) return;
-    for (int i = 0; i < data->nloci; i++)
-    {
-        delete [] data->data[i];
-    }
-
-    delete [] data->data;
+#ifdef _WIN32
+    freeGenoBlock(data->data);
+#else
+    if (data->mappedBytes > 0) munmap(data->data, data->mappedBytes);
+    else freeGenoBlock(data->data);
+#endif
+    if (data->alleleCount != NULL) delete [] data->alleleCount;
+    if (data->calledCount != NULL) delete [] data->calledCount;
 
     data->data = NULL;
     data->nind = -9;
@@ -1073,6 +2539,7 @@ int countFields(const string &str)
     return numFields;
 }
 
+/*
 vector< int_pair_t > *scanTPEDMapData(string filename, int &numLoci, int &numCols)
 {
     igzstream fin;
@@ -1142,6 +2609,7 @@ vector< int_pair_t > *scanTPEDMapData(string filename, int &numLoci, int &numCol
 
     return chrStartStop;
 }
+*/
 
 string lc(string str) {
     char c[2] = {' ', '\0'};
@@ -1159,6 +2627,7 @@ string checkChrName(string chr) {
     return chr;
 }
 
+/*
 vector< MapData * > *readTPEDMapData(string filename, int numCols, vector< int_pair_t > *chrCoordList, char TPED_MISSING)
 {
     vector< MapData * > *mapDataByChr = new vector< MapData * >;
@@ -1218,6 +2687,7 @@ vector< MapData * > *readTPEDMapData(string filename, int numCols, vector< int_p
 
     return mapDataByChr;
 }
+*/
 
 
 void scanIndData3(string filename, int &numInd, string &popName) {
@@ -1492,11 +2962,9 @@ void releaseDoubleData(vector < DoubleData * > *rawWinDataByPop)
     return;
 }
 
-void subsetData(vector< HapData * > *hapDataByChr,
-                IndData *indData,
-                vector< HapData * > **subsetHapDataByChr,
-                IndData **subsetIndData,
-                int subsample)
+//Draws the individuals used for KDE and reports them.  Returns their
+//indices into indData, subsetIndData->nind of them.
+int *selectSubsample(IndData *indData, int subsample, IndData **subsetIndData)
 {
     const gsl_rng_type *T;
     gsl_rng *r;
@@ -1504,7 +2972,7 @@ void subsetData(vector< HapData * > *hapDataByChr,
     r = gsl_rng_alloc (T);
     gsl_rng_set(r, time(NULL));
 
-    int nind = hapDataByChr->at(0)->nind;
+    int nind = indData->nind;
     int *randInd;
     if (subsample >= nind)
     {
@@ -1532,6 +3000,21 @@ void subsetData(vector< HapData * > *hapDataByChr,
     cout << "\n";
     LOG.loga("Individuals used for KDE:", newIndData->indID, nind);
 
+    *(subsetIndData) = newIndData;
+    gsl_rng_free(r);
+    return randInd;
+}
+
+void subsetData(vector< HapData * > *hapDataByChr,
+                IndData *indData,
+                vector< HapData * > **subsetHapDataByChr,
+                IndData **subsetIndData,
+                int subsample)
+{
+    IndData *newIndData;
+    int *randInd = selectSubsample(indData, subsample, &newIndData);
+    int nind = newIndData->nind;
+
     vector< HapData * > *newHapDataByChr = new vector< HapData * >;
 
     int nchr = hapDataByChr->size();
@@ -1545,7 +3028,7 @@ void subsetData(vector< HapData * > *hapDataByChr,
         {
             for (int ind = 0; ind < nind; ind++)
             {
-                hapData->data[locus][ind] = hapDataByChr->at(chr)->data[locus][randInd[ind]];
+                setGenotype(hapData, locus, ind, getGenotype(hapDataByChr->at(chr), locus, randInd[ind]));
             }
         }
         newHapDataByChr->push_back(hapData);
@@ -1555,7 +3038,6 @@ void subsetData(vector< HapData * > *hapDataByChr,
 
     *(subsetHapDataByChr) = newHapDataByChr;
     *(subsetIndData) = newIndData;
-    gsl_rng_free(r);
     return;
 }
 
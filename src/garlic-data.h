@@ -8,8 +8,19 @@
 #include <ctime>
 #include <cstdlib>
 #include <cctype>
+#include <cstring>
 #include <map>
+#include <stdint.h>
 #include "gzstream.h"
+#ifndef _WIN32
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <malloc.h>
+#endif
 #include "gsl/gsl_rng.h"
 #include "gsl/gsl_randist.h"
 #include "garlic-errlog.h"
@@ -24,13 +35,84 @@ struct int_pair_t
     int second;
 };
 
+//Genotypes are packed 2 bits per individual in a single 64 byte aligned
+//block, one run of wordsPerLocus words per locus.  Individual ind sits
+//in bits 2*(ind%32) of word ind/32.  Codes 0-2 count copies of the
+//first allele and 3 is missing, as are the padding bits past nind.
+//alleleCount and calledCount hold the copies of the first allele and
+//the non-missing genotypes at each locus.  The loaders tally them as
+//each row is parsed; they are NULL for HapData built any other way.
+//mappedBytes is nonzero when data is a private mapping of a genotype
+//cache rather than an allocation.
 struct HapData
 {
-    short **data;
+    uint64_t *data;
+    int wordsPerLocus;
     int nind;
     int nloci;
+    int *alleleCount;
+    int *calledCount;
+    size_t mappedBytes;
 };
 
+const uint64_t HAP_MISSING_WORD = ~uint64_t(0);
+const uint64_t HAP_LOW_BITS = 0x5555555555555555ULL;
+
+inline int hapWordsPerLocus(int nind)
+{
+    return (nind + 31) / 32;
+}
+
+inline uint64_t *getHapLocus(const HapData *hapData, int locus)
+{
+    return hapData->data + (size_t)locus * hapData->wordsPerLocus;
+}
+
+//Returns 0, 1, 2 or -9 for missing
+inline short getGenotype(const uint64_t *row, int ind)
+{
+    static const short decode[4] = {0, 1, 2, -9};
+    return decode[(row[ind >> 5] >> ((ind & 31) << 1)) & 3];
+}
+
+//Copies of the first allele and non-missing genotypes in one packed
+//row, a word of 32 genotypes at a time.  The low and high bits of each
+//code are both set only for missing genotypes (and padding).
+inline void countHapRow(const uint64_t *row, int wordsPerLocus, int nind, int &alleles, int &called)
+{
+    int nmissing = 0, nlow = 0, nhigh = 0;
+    for (int w = 0; w < wordsPerLocus; w++)
+    {
+        uint64_t low = row[w] & HAP_LOW_BITS;
+        uint64_t high = (row[w] >> 1) & HAP_LOW_BITS;
+        uint64_t missing = low & high;
+        nmissing += __builtin_popcountll(missing);
+        nlow += __builtin_popcountll(low & ~missing);
+        nhigh += __builtin_popcountll(high & ~missing);
+    }
+    int npad = 32 * wordsPerLocus - nind;
+    called = nind - (nmissing - npad);
+    alleles = nlow + 2 * nhigh;
+}
+
+inline short getGenotype(const HapData *hapData, int locus, int ind)
+{
+    return getGenotype(getHapLocus(hapData, locus), ind);
+}
+
+//Any negative genotype is stored as missing
+inline void setGenotype(uint64_t *row, int ind, short genotype)
+{
+    uint64_t code = (genotype < 0) ? 3 : genotype;
+    int shift = (ind & 31) << 1;
+    row[ind >> 5] = (row[ind >> 5] & ~(uint64_t(3) << shift)) | (code << shift);
+}
+
+inline void setGenotype(HapData *hapData, int locus, int ind, short genotype)
+{
+    setGenotype(getHapLocus(hapData, locus), ind, genotype);
+}
+
 struct MapData
 {
     int *physicalPos;
@@ -73,9 +155,8 @@ int filterMonomorphicSites(vector< MapData * > **mapDataByChr,
                            vector< HapData * > **hapDataByChr,
                            vector< FreqData * > **freqDataByChr);
 
-MapData *filterMonomorphicSites(MapData *mapData, FreqData *freqData, int &newLoci);
-HapData *filterMonomorphicSites(HapData *hapData, FreqData *freqData, int &newLoci);
-FreqData *filterMonomorphicSites(FreqData *freqData, int &newLoci);
+//Compacts one chromosome in place and returns the loci kept
+int filterMonomorphicSites(MapData *mapData, HapData *hapData, FreqData *freqData);
 
 string getPost(int num);
 bool goodDouble(string str);
@@ -96,13 +177,16 @@ void writeFreqData(string freqOutfile, string popName,
 
 vector< FreqData * > *readFreqData(string freqfile, string popName,
                                    vector< int_pair_t > *chrCoordList,
-                                   vector< MapData * > *mapDataByChr);
+                                   vector< MapData * > *mapDataByChr,
+                                   bool useCache);
 
 vector< int_pair_t > *scanTFAMData(string filename, int &numInd);
 vector< IndData * > *readTFAMData(string filename, vector< int_pair_t > *indCoordList);
 
+/*
 vector< int_pair_t > *scanTPEDMapData(string filename, int &numLoci, int &numCols);
 vector< MapData * > *readTPEDMapData(string filename, int numCols, vector< int_pair_t > *chrCoordList, char TPED_MISSING);
+*/
 /*
 void writeTPEDDataByPop(string outfile,
                         vector< vector< HapData * >* > *hapDataByPopByChr,
@@ -111,11 +195,33 @@ void writeTPEDDataByPop(string outfile,
 void writeTFAMDataByPop(string outfile, vector< IndData * > *indDataByPop, map<string, int> &pop2index);
 */
 
+/*
 vector< HapData * > *readTPEDHapData3(string filename,
                                       int expectedLoci,
                                       int expectedInd,
                                       char TPED_MISSING,
                                       vector< MapData * > *mapDataByChr);
+*/
+
+//Reads the map information and genotypes of a TPED file in a single pass
+void readTPEDData(string filename,
+                  int expectedInd,
+                  char TPED_MISSING,
+                  int numThreads,
+                  vector< MapData * > **mapDataByChr,
+                  vector< HapData * > **hapDataByChr,
+                  vector< int_pair_t > **chrCoordList,
+                  int &numLoci);
+
+vector< MapData * > *readBIMData(string filename, vector< int_pair_t > **chrCoordList, int &numLoci);
+vector< HapData * > *readBEDData(string filename, int expectedInd, vector< MapData * > *mapDataByChr);
+
+void readVCFData(string filename,
+                 IndData **indData,
+                 vector< MapData * > **mapDataByChr,
+                 vector< HapData * > **hapDataByChr,
+                 vector< int_pair_t > **chrCoordList,
+                 int &numLoci);
 
 MapData *initMapData(int nloci);
 void releaseMapData(MapData *data);
@@ -127,9 +233,12 @@ IndData *initIndData(int nind);
 void releaseIndData(IndData *data);
 
 HapData *initHapData(unsigned int nind, unsigned int nloci);
+void initHapCounts(HapData *data);
 void releaseHapData(HapData *data);
 void releaseHapData(vector< HapData * > *hapDataByChr);
 
+int *selectSubsample(IndData *indData, int subsample, IndData **subsetIndData);
+
 void subsetData(vector< HapData * > *hapDataByChr,
                 IndData *indData,
                 vector< HapData * > **subsetHapDataByChr,
@@ -1,6 +1,6 @@
 #include "garlic-kde.h"
 
-//pthread_mutex_t kde_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t kde_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 KDEWinsizeReport *initKDEWinsizeReport()
 {
@@ -35,21 +35,42 @@ double calculateWiggle(KDEResult *kdeResult, int winsize) {
     return tot;
 }
 
-KDEResult *computeKDE(double *data, int size)
+static int KDE_ENGINE = KDE_FIGTREE;
+static int KDE_BANDWIDTH = KDE_BW_NRD0;
+
+void setKDEEngine(int engine)
 {
+    KDE_ENGINE = engine;
+}
 
-    //Used, as in the R function density, to extend the range of the fixed width points
-    //used to compute the KDE
-    double CUT = 3;
+int getKDEEngine()
+{
+    return KDE_ENGINE;
+}
 
-    // The dimensionality of each sample vector.
-    int d = 1;
+void setKDEBandwidth(int selector)
+{
+    KDE_BANDWIDTH = selector;
+}
 
-    // The number of targets (vectors at which gauss transform is evaluated).
-    int M = 512;
+int getKDEBandwidth()
+{
+    return KDE_BANDWIDTH;
+}
 
-    // The number of sources which will be used for the gauss transform.
-    int n = size;
+static double selectBandwidth(LODHistogram *hist)
+{
+    if (KDE_BANDWIDTH == KDE_BW_SJ) return bwSJ(hist);
+    return nrd0(hist);
+}
+
+//Sum over the sources of w * exp(-(x - t)^2 / h^2) / n at each target
+//t, as computed by FIGTree.  Sources have weight 1 if w is NULL.
+static void figtreeKDE(const double *x, const double *w, int m, double n, double h,
+                       double *targets, int M, double *kde_points)
+{
+    // The dimensionality of each sample vector.
+    int d = 1;
 
     // Desired maximum absolute error after normalizing output by sum of weights.
     // If the weights, q_i (see below), add up to 1, then this is will be the
@@ -62,9 +83,101 @@ KDEResult *computeKDE(double *data, int size)
     // but by giving multiple sets of weights at once some overhead can be shared.
     int W = 1;
 
-    double h = nrd0(data, size); // bandwitdh
-    double min, max;
-    gsl_stats_minmax(&min, &max, data, 1, n);
+    //Weights, man what a waste of memory...
+    double *q = new double[m];
+    for (int i = 0; i < m; i++)
+    {
+        q[i] = ((w == NULL) ? 1.0 : w[i]) / n;
+    }
+
+    //figtree not thread safe due to dependent libraries using global vars somewhere
+    pthread_mutex_lock(&kde_mutex);
+    figtree( d, m, M, W, (double *)x, h, q, targets, epsilon, kde_points );
+    pthread_mutex_unlock(&kde_mutex);
+
+    delete [] q;
+    return;
+}
+
+//The same transform with the sources linearly binned onto a grid
+//KDE_FFT_OVERSAMPLE times finer than the equally spaced targets, so
+//that it becomes a discrete convolution with the kernel.  The
+//convolution is zero padded to avoid wrap around and done by FFT, so
+//time is O(m + M log M) and memory O(M).
+static void fftKDE(const double *x, const double *w, int m, double n, double h,
+                   double *targets, int M, double *kde_points)
+{
+    int G = (M - 1) * KDE_FFT_OVERSAMPLE + 1;
+    double delta = (targets[M - 1] - targets[0]) / double(G - 1);
+    size_t L = 1;
+    while (L < size_t(2 * G)) L <<= 1;
+
+    //Interleaved real and imaginary parts
+    double *binned = new double[2 * L];
+    double *kernel = new double[2 * L];
+    for (size_t i = 0; i < 2 * L; i++)
+    {
+        binned[i] = 0;
+        kernel[i] = 0;
+    }
+
+    for (int i = 0; i < m; i++)
+    {
+        double weight = (w == NULL) ? 1.0 : w[i];
+        double u = (x[i] - targets[0]) / delta;
+        if (u <= 0) binned[0] += weight;
+        else if (u >= G - 1) binned[2 * (G - 1)] += weight;
+        else
+        {
+            int j = int(u);
+            double frac = u - j;
+            binned[2 * j] += weight * (1 - frac);
+            binned[2 * (j + 1)] += weight * frac;
+        }
+    }
+
+    for (int j = 0; j < G; j++)
+    {
+        double dist = j * delta / h;
+        double k = exp(-dist * dist);
+        kernel[2 * j] = k;
+        if (j > 0) kernel[2 * (L - j)] = k;
+    }
+
+    gsl_fft_complex_radix2_forward(binned, 1, L);
+    gsl_fft_complex_radix2_forward(kernel, 1, L);
+    for (size_t i = 0; i < L; i++)
+    {
+        double re = binned[2 * i] * kernel[2 * i] - binned[2 * i + 1] * kernel[2 * i + 1];
+        double im = binned[2 * i] * kernel[2 * i + 1] + binned[2 * i + 1] * kernel[2 * i];
+        binned[2 * i] = re;
+        binned[2 * i + 1] = im;
+    }
+    gsl_fft_complex_radix2_inverse(binned, 1, L);
+
+    for (int i = 0; i < M; i++)
+    {
+        kde_points[i] = binned[2 * i * KDE_FFT_OVERSAMPLE] / n;
+    }
+
+    delete [] binned;
+    delete [] kernel;
+    return;
+}
+
+//KDE of n observations given as m weighted sources, with bandwidth h
+//and observed range [min, max]
+static KDEResult *computeKDE(const double *x, const double *w, int m, double n,
+                             double h, double min, double max)
+{
+
+    //Used, as in the R function density, to extend the range of the fixed width points
+    //used to compute the KDE
+    double CUT = 3;
+
+    // The number of targets (vectors at which gauss transform is evaluated).
+    int M = 512;
+
     max += CUT * h;
     min -= CUT * h;
 
@@ -91,19 +204,8 @@ KDEResult *computeKDE(double *data, int size)
 
     double targetPointSpacing = targets[1] - targets[0];
 
-    //Weights, man what a waste of memory...
-    double *q = new double[n];
-    for (int i = 0; i < n; i++)
-    {
-        q[i] = 1.0 / double(n);
-    }
-
-    //figtree not thread safe due to dependent libraries using global vars somewhere
-    //pthread_mutex_lock(&kde_mutex);
-    figtree( d, n, M, W, data, h, q, targets, epsilon, kde_points );
-    //pthread_mutex_unlock(&kde_mutex);
-
-    delete [] q;
+    if (KDE_ENGINE == KDE_FFT) fftKDE(x, w, m, n, h, targets, M, kde_points);
+    else figtreeKDE(x, w, m, n, h, targets, M, kde_points);
 
     double sum = 0;
     for (int i = 0; i < M; i++)
@@ -124,6 +226,151 @@ KDEResult *computeKDE(double *data, int size)
     return kdeResult;
 }
 
+KDEResult *computeKDE(double *data, int size)
+{
+    LODHistogram *hist = initLODHistogram();
+    for (int i = 0; i < size; i++) addLODHistogram(hist, data[i]);
+    double h = selectBandwidth(hist); // bandwitdh
+    double min = hist->min;
+    double max = hist->max;
+    releaseLODHistogram(hist);
+    return computeKDE(data, NULL, size, size, h, min, max);
+}
+
+//Each occupied bin is one source at its centre, weighted by its count
+KDEResult *computeKDE(LODHistogram *hist)
+{
+    double h = selectBandwidth(hist);
+
+    int m = 0;
+    for (int i = 0; i < LOD_HIST_BINS; i++) if (hist->count[i] > 0) m++;
+    double *x = new double[m];
+    double *w = new double[m];
+    m = 0;
+    for (int i = 0; i < LOD_HIST_BINS; i++)
+    {
+        if (hist->count[i] > 0)
+        {
+            x[m] = (hist->lo + i + 0.5) * hist->width;
+            w[m] = hist->count[i];
+            m++;
+        }
+    }
+
+    KDEResult *kdeResult = computeKDE(x, w, m, hist->n, h, hist->min, hist->max);
+    delete [] x;
+    delete [] w;
+    return kdeResult;
+}
+
+LODHistogram *initLODHistogram()
+{
+    LODHistogram *hist = new LODHistogram;
+    hist->count = new double[LOD_HIST_BINS];
+    for (int i = 0; i < LOD_HIST_BINS; i++) hist->count[i] = 0;
+    hist->lo = -LOD_HIST_BINS / 2;
+    hist->width = LOD_HIST_WIDTH;
+    hist->n = 0;
+    hist->min = 0;
+    hist->max = 0;
+    hist->shift = 0;
+    hist->sum = 0;
+    hist->sumSq = 0;
+    return hist;
+}
+
+void releaseLODHistogram(LODHistogram *hist)
+{
+    if (hist == NULL) return;
+    delete [] hist->count;
+    delete hist;
+    return;
+}
+
+static long floorDiv(long k, long factor)
+{
+    return (k >= 0) ? k / factor : -((-k + factor - 1) / factor);
+}
+
+//Widens the bins to at least the given width, and further until
+//[min, max] fits, and moves the stored bins to cover it
+void fitLODHistogram(LODHistogram *hist, double width, double min, double max)
+{
+    double w = GSL_MAX(width, hist->width);
+    while ((long)floor(max / w) - (long)floor(min / w) + 1 > LOD_HIST_BINS) w *= 2;
+
+    long first = (long)floor(min / w);
+    long last = (long)floor(max / w);
+    if (w == hist->width && first >= hist->lo && last < hist->lo + LOD_HIST_BINS) return;
+
+    long lo = first - (LOD_HIST_BINS - (last - first + 1)) / 2;
+    long factor = (long)(w / hist->width + 0.5);
+    double *count = new double[LOD_HIST_BINS];
+    for (int i = 0; i < LOD_HIST_BINS; i++) count[i] = 0;
+    for (int i = 0; i < LOD_HIST_BINS; i++)
+    {
+        if (hist->count[i] > 0) count[floorDiv(hist->lo + i, factor) - lo] += hist->count[i];
+    }
+
+    delete [] hist->count;
+    hist->count = count;
+    hist->lo = lo;
+    hist->width = w;
+    return;
+}
+
+void mergeLODHistogram(LODHistogram *hist, LODHistogram *other)
+{
+    if (other->n == 0) return;
+    if (hist->n == 0)
+    {
+        hist->min = other->min;
+        hist->max = other->max;
+        hist->shift = other->shift;
+    }
+
+    fitLODHistogram(hist, other->width, GSL_MIN(hist->min, other->min), GSL_MAX(hist->max, other->max));
+    long factor = (long)(hist->width / other->width + 0.5);
+    for (int i = 0; i < LOD_HIST_BINS; i++)
+    {
+        if (other->count[i] > 0) hist->count[floorDiv(other->lo + i, factor) - hist->lo] += other->count[i];
+    }
+
+    double d = other->shift - hist->shift;
+    hist->sumSq += other->sumSq + 2 * d * other->sum + other->n * d * d;
+    hist->sum += other->sum + other->n * d;
+    hist->n += other->n;
+    hist->min = GSL_MIN(hist->min, other->min);
+    hist->max = GSL_MAX(hist->max, other->max);
+    return;
+}
+
+//As gsl_stats_quantile_from_sorted_data, with the scores in a bin taken
+//to be evenly spread across it
+double quantileLODHistogram(LODHistogram *hist, double f)
+{
+    double index = f * (hist->n - 1);
+    double cum = 0;
+    for (int i = 0; i < LOD_HIST_BINS; i++)
+    {
+        double c = hist->count[i];
+        if (c > 0 && cum + c > index)
+        {
+            double x = (hist->lo + i + (index - cum + 0.5) / c) * hist->width;
+            return GSL_MAX(hist->min, GSL_MIN(hist->max, x));
+        }
+        cum += c;
+    }
+    return hist->max;
+}
+
+double sdLODHistogram(LODHistogram *hist)
+{
+    if (hist->n < 2) return 0;
+    double var = (hist->sumSq - hist->sum * hist->sum / hist->n) / (hist->n - 1);
+    return (var > 0) ? sqrt(var) : 0;
+}
+
 
 KDEResult *cloneKDEResult(KDEResult *data)
 {
@@ -149,18 +396,144 @@ void releaseKDEResult(KDEResult *data)
     return;
 }
 
+//The quartiles are read from a histogram of the data rather than by
+//sorting it, so this is linear time and leaves x untouched.  They are
+//off by at most a bin width, about (max - min) / LOD_HIST_BINS.
 double nrd0(double x[], const int N)
 {
-    gsl_sort(x, 1, N);
-    double hi = gsl_stats_sd(x, 1, N);
-    double iqr =
-        gsl_stats_quantile_from_sorted_data (x, 1, N, 0.75) -
-        gsl_stats_quantile_from_sorted_data (x, 1, N, 0.25);
+    LODHistogram *hist = initLODHistogram();
+    for (int i = 0; i < N; i++) addLODHistogram(hist, x[i]);
+    double bw = nrd0(hist);
+    releaseLODHistogram(hist);
+    return (bw);
+}
+
+double nrd0(LODHistogram *hist)
+{
+    double hi = sdLODHistogram(hist);
+    double iqr = quantileLODHistogram(hist, 0.75) - quantileLODHistogram(hist, 0.25);
     double lo = GSL_MIN(hi, iqr / 1.34);
-    double bw = 0.9 * lo * pow(N, -0.2);
+    double bw = 0.9 * lo * pow(hist->n, -0.2);
     return (bw);
 }
 
+//Estimates of the integrated squared 2nd (phi4) and 3rd (phi6)
+//derivatives of the density with bandwidth h, from counts of pairs of
+//observations cnt[k] k bins of width d apart
+static double sjPhi4(double n, double d, const double *cnt, int nb, double h)
+{
+    double sum = 0;
+    for (int i = 0; i < nb; i++)
+    {
+        double delta = i * d / h;
+        delta *= delta;
+        if (delta >= 1000) break;
+        sum += exp(-delta / 2) * (delta * delta - 6 * delta + 3) * cnt[i];
+    }
+    sum = 2 * sum + n * 3;
+    return sum / (n * (n - 1) * pow(h, 5.0) * sqrt(2 * M_PI));
+}
+
+static double sjPhi6(double n, double d, const double *cnt, int nb, double h)
+{
+    double sum = 0;
+    for (int i = 0; i < nb; i++)
+    {
+        double delta = i * d / h;
+        delta *= delta;
+        if (delta >= 1000) break;
+        sum += exp(-delta / 2) * (delta * delta * delta - 15 * delta * delta + 45 * delta - 15) * cnt[i];
+    }
+    sum = 2 * sum - 15 * n;
+    return sum / (n * (n - 1) * pow(h, 7.0) * sqrt(2 * M_PI));
+}
+
+//Sheather-Jones 'solve-the-equation' bandwidth, following R's bw.SJ.
+//The histogram is rebinned onto KDE_SJ_BINS bins and pairs are counted
+//by bin distance, so the cost is linear in the number of scores plus
+//KDE_SJ_BINS^2.  Falls back to nrd0 if the sample is too sparse.
+double bwSJ(LODHistogram *hist)
+{
+    double n = hist->n;
+    int nb = KDE_SJ_BINS;
+    double d = (hist->max - hist->min) * 1.01 / nb;
+    if (n < 2 || d <= 0) return nrd0(hist);
+
+    double *binned = new double[nb];
+    double *cnt = new double[nb];
+    for (int i = 0; i < nb; i++)
+    {
+        binned[i] = 0;
+        cnt[i] = 0;
+    }
+    for (int i = 0; i < LOD_HIST_BINS; i++)
+    {
+        if (hist->count[i] == 0) continue;
+        double x = GSL_MAX(hist->min, GSL_MIN(hist->max, (hist->lo + i + 0.5) * hist->width));
+        int b = int((x - hist->min) / d);
+        if (b >= nb) b = nb - 1;
+        binned[b] += hist->count[i];
+    }
+    for (int i = 0; i < nb; i++)
+    {
+        if (binned[i] == 0) continue;
+        cnt[0] += binned[i] * (binned[i] - 1) / 2;
+        for (int j = i + 1; j < nb; j++) cnt[j - i] += binned[i] * binned[j];
+    }
+    delete [] binned;
+
+    double scale = GSL_MIN(sdLODHistogram(hist),
+                           (quantileLODHistogram(hist, 0.75) - quantileLODHistogram(hist, 0.25)) / 1.349);
+    double a = 1.24 * scale * pow(n, -1.0 / 7.0);
+    double b = 1.23 * scale * pow(n, -1.0 / 9.0);
+    double c1 = 1 / (2 * sqrt(M_PI) * n);
+    double TD = -sjPhi6(n, d, cnt, nb, b);
+    double alph2 = 1.357 * pow(sjPhi4(n, d, cnt, nb, a) / TD, 1.0 / 7.0);
+    if (!(TD > 0) || !gsl_finite(alph2))
+    {
+        delete [] cnt;
+        LOG.log("Sample too sparse for Sheather-Jones bandwidth, using nrd0.");
+        return nrd0(hist);
+    }
+
+    double hmax = 1.144 * scale * pow(n, -0.2);
+    double lower = 0.1 * hmax;
+    double upper = hmax;
+    double tol = 0.1 * lower;
+
+    //fSD(h) = (c1 / phi4(alph2 * h^(5/7)))^(1/5) - h
+    double fLower = pow(c1 / sjPhi4(n, d, cnt, nb, alph2 * pow(lower, 5.0 / 7.0)), 0.2) - lower;
+    double fUpper = pow(c1 / sjPhi4(n, d, cnt, nb, alph2 * pow(upper, 5.0 / 7.0)), 0.2) - upper;
+    for (int itry = 1; fLower * fUpper > 0; itry++)
+    {
+        if (itry > 99 || !gsl_finite(fLower) || !gsl_finite(fUpper))
+        {
+            delete [] cnt;
+            LOG.log("No Sheather-Jones bandwidth found, using nrd0.");
+            return nrd0(hist);
+        }
+        if (itry % 2) upper *= 1.2;
+        else lower /= 1.2;
+        fLower = pow(c1 / sjPhi4(n, d, cnt, nb, alph2 * pow(lower, 5.0 / 7.0)), 0.2) - lower;
+        fUpper = pow(c1 / sjPhi4(n, d, cnt, nb, alph2 * pow(upper, 5.0 / 7.0)), 0.2) - upper;
+    }
+
+    while (upper - lower > tol)
+    {
+        double mid = (lower + upper) / 2;
+        double fMid = pow(c1 / sjPhi4(n, d, cnt, nb, alph2 * pow(mid, 5.0 / 7.0)), 0.2) - mid;
+        if ((fMid < 0) == (fLower < 0))
+        {
+            lower = mid;
+            fLower = fMid;
+        }
+        else upper = mid;
+    }
+
+    delete [] cnt;
+    return (lower + upper) / 2;
+}
+
 double get_min_btw_modes(double *x, double *y, int size)
 {
     //double initialGuess = 0;
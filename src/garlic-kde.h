@@ -7,15 +7,55 @@
 #include <string>
 #include <cstring>
 #include <limits>
-//#include <pthread.h>
+#include <pthread.h>
 #include <gsl/gsl_statistics.h>
 #include <gsl/gsl_sort.h>
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_fit.h>
+#include <gsl/gsl_fft_complex.h>
 #include "figtree.h"
 #include "garlic-data.h"
 #include "garlic-errlog.h"
 
+//Engines used by computeKDE to evaluate the Gauss transform
+const int KDE_FIGTREE = 0;
+const int KDE_FFT = 1;
+
+//The FFT engine bins the data on a grid this many times finer than the
+//KDE points
+const int KDE_FFT_OVERSAMPLE = 8;
+
+//Bandwidth selectors used by computeKDE
+const int KDE_BW_NRD0 = 0;
+const int KDE_BW_SJ = 1;
+
+//Bins the Sheather-Jones selector works on, as in R's bw.SJ
+const int KDE_SJ_BINS = 1000;
+
+//Bins kept by a LODHistogram and the bin width it starts from
+const int LOD_HIST_BINS = 16384;
+const double LOD_HIST_WIDTH = 1.0 / 256.0;
+
+//Fine-grained histogram of LOD window scores, with the exact number of
+//scores, extremes and moments kept alongside.  Bin k holds scores in
+//[k * width, (k + 1) * width), and bins lo .. lo + LOD_HIST_BINS - 1 are
+//stored.  A score that does not fit doubles the width (merging pairs of
+//bins) until all scores do, so bins always line up and histograms
+//filled separately can be merged.  Moments are taken about the first
+//score seen to avoid cancellation.
+struct LODHistogram
+{
+    double *count;
+    long lo;
+    double width;
+    double n;
+    double min;
+    double max;
+    double shift;
+    double sum;
+    double sumSq;
+};
+
 struct KDEResult
 {
     int size;
@@ -39,8 +79,48 @@ struct KDEWinsizeReport
 };
 
 double nrd0(double *data, const int n);
+double nrd0(LODHistogram *hist);
+double bwSJ(LODHistogram *hist);
+
+void setKDEBandwidth(int selector);
+int getKDEBandwidth();
+
+LODHistogram *initLODHistogram();
+void releaseLODHistogram(LODHistogram *hist);
+void fitLODHistogram(LODHistogram *hist, double width, double min, double max);
+void mergeLODHistogram(LODHistogram *hist, LODHistogram *other);
+double quantileLODHistogram(LODHistogram *hist, double f);
+double sdLODHistogram(LODHistogram *hist);
+
+inline void addLODHistogram(LODHistogram *hist, double x)
+{
+    if (hist->n == 0)
+    {
+        hist->min = x;
+        hist->max = x;
+        hist->shift = x;
+        hist->lo = (long)floor(x / hist->width) - LOD_HIST_BINS / 2;
+    }
+    long k = (long)floor(x / hist->width);
+    if (k < hist->lo || k >= hist->lo + LOD_HIST_BINS)
+    {
+        fitLODHistogram(hist, hist->width, GSL_MIN(x, hist->min), GSL_MAX(x, hist->max));
+        k = (long)floor(x / hist->width);
+    }
+    hist->count[k - hist->lo] += 1;
+    hist->n += 1;
+    if (x < hist->min) hist->min = x;
+    if (x > hist->max) hist->max = x;
+    double d = x - hist->shift;
+    hist->sum += d;
+    hist->sumSq += d * d;
+}
+
+void setKDEEngine(int engine);
+int getKDEEngine();
 
 KDEResult *computeKDE(double *data, int size);
+KDEResult *computeKDE(LODHistogram *hist);
 KDEResult *cloneKDEResult(KDEResult *data);
 void releaseKDEResult(KDEResult *data);
 void writeKDEResult(KDEResult *kdeResult, string outfile);
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <cstdio>
 #include <fstream>
+#include <iterator>
 #include <cmath>
 //#include <pthread.h>
 #include "garlic-data.h"
@@ -10,6 +11,8 @@
 #include "garlic-kde.h"
 #include "param_t.h"
 #include "garlic-centromeres.h"
+#include "garlic-bgzf.h"
+#include "garlic-cache.h"
 
 using namespace std;
 
@@ -22,6 +25,35 @@ string getCommandLineString(int argc, char *argv[])
     return str;
 }
 
+//Stage cache keys are built up from each parameter a stage depends on.
+//An empty key means the stage is not cached and stays empty.
+string extendStageKey(string key, string name, string value)
+{
+    if (key.empty()) return key;
+    return key + "|" + name + " " + value;
+}
+
+string extendStageKey(string key, string name, int value)
+{
+    char str[32];
+    snprintf(str, sizeof(str), "%d", value);
+    return extendStageKey(key, name, string(str));
+}
+
+string extendStageKey(string key, string name, double value)
+{
+    char str[32];
+    snprintf(str, sizeof(str), "%.17g", value);
+    return extendStageKey(key, name, string(str));
+}
+
+string extendStageKey(string key, string name, const vector< string > &files)
+{
+    string filesKey = cacheInputKey(files);
+    if (filesKey.empty()) return filesKey;
+    return extendStageKey(key, name, filesKey);
+}
+
 int main(int argc, char *argv[])
 {
 //++++++++++CLI handling++++++++++
@@ -37,12 +69,36 @@ int main(int argc, char *argv[])
 
     string tpedfile = params->getStringFlag(ARG_TPED);
     string tfamfile = params->getStringFlag(ARG_TFAM);
-    argerr = argerr || checkRequiredFiles(tpedfile, tfamfile);
+    string bfile = params->getStringFlag(ARG_BFILE);
+    string vcffile = params->getStringFlag(ARG_VCF);
+    argerr = argerr || checkRequiredFiles(tpedfile, tfamfile, bfile, vcffile);
     if (argerr) return -1;
-    LOG.log("TPED file:", tpedfile);
+    bool BFILE = (bfile.compare(DEFAULT_BFILE) != 0);
+    bool VCF = (vcffile.compare(DEFAULT_VCF) != 0);
     char TPED_MISSING = params->getCharFlag(ARG_TPED_MISSING);
-    LOG.log("TPED missing data code:", TPED_MISSING);
-    LOG.log("TFAM file:", tfamfile);
+    string cacheDir = params->getStringFlag(ARG_CACHE);
+    bool CACHE = (cacheDir.compare(DEFAULT_CACHE) != 0);
+    if (CACHE) argerr = argerr || checkCacheDir(cacheDir);
+    bool CACHE_WINDOWS = params->getBoolFlag(ARG_CACHE_WINDOWS);
+    argerr = argerr || checkCacheWindows(CACHE, CACHE_WINDOWS);
+    if (argerr) return -1;
+    if (CACHE) LOG.log("Genotype cache directory:", cacheDir);
+    if (CACHE) LOG.log("Cache window scores:", CACHE_WINDOWS);
+    if (BFILE)
+    {
+        tfamfile = bfile + ".fam";
+        LOG.log("PLINK binary fileset:", bfile);
+    }
+    else if (VCF)
+    {
+        LOG.log("VCF file:", vcffile);
+    }
+    else
+    {
+        LOG.log("TPED file:", tpedfile);
+        LOG.log("TPED missing data code:", TPED_MISSING);
+        LOG.log("TFAM file:", tfamfile);
+    }
 
     string BUILD = params->getStringFlag(ARG_BUILD);
     argerr = argerr || checkBuild(BUILD);
@@ -62,7 +118,12 @@ int main(int argc, char *argv[])
     if (argerr) return -1;
     LOG.log("Calculate allele frequencies only:", FREQ_ONLY);
     LOG.log("Calculate allele frequencies from data:", AUTO_FREQ);
-    if (!AUTO_FREQ) LOG.log("Allele frequencies file:", freqfile);
+    bool FREQ_CACHE = params->getBoolFlag(ARG_FREQ_CACHE);
+    if (!AUTO_FREQ)
+    {
+        LOG.log("Allele frequencies file:", freqfile);
+        LOG.log("Cache allele frequencies file:", FREQ_CACHE);
+    }
     else
     {
         if (nresample <= 0) LOG.log("Allele frequencies resampled: FALSE");
@@ -86,6 +147,11 @@ int main(int argc, char *argv[])
     if (argerr) return -1;
     LOG.log("Automatic window step size:", AUTO_WINSIZE_STEP);
 
+    string AUTO_WINSIZE_SEARCH = params->getStringFlag(ARG_AUTO_WINSIZE_SEARCH);
+    argerr = argerr || checkAutoWinsizeSearch(AUTO_WINSIZE_SEARCH);
+    if (argerr) return -1;
+    LOG.log("Automatic window search:", AUTO_WINSIZE_SEARCH);
+
     int winsize = params->getIntFlag(ARG_WINSIZE);
     argerr = argerr || checkWinsize(winsize);
     if (argerr) return -1;
@@ -105,11 +171,25 @@ int main(int argc, char *argv[])
     LOG.log("Choose ROH class thresholds automatically:", AUTO_BOUNDS);
     if (!AUTO_BOUNDS) LOG.logv("User defined ROH class thresholds:", boundSizes);
 
-/*
+    int GMM_BIN_WIDTH = params->getIntFlag(ARG_GMM_BIN_WIDTH);
+    argerr = argerr || checkGMMBinWidth(GMM_BIN_WIDTH);
+    if (argerr) return -1;
+    if (AUTO_BOUNDS && GMM_BIN_WIDTH > 0) LOG.log("GMM length bin width:", GMM_BIN_WIDTH);
+
+    int GMM_RESTARTS = params->getIntFlag(ARG_GMM_RESTARTS);
+    argerr = argerr || checkGMMRestarts(GMM_RESTARTS);
+    if (argerr) return -1;
+    if (AUTO_BOUNDS) LOG.log("GMM restarts:", GMM_RESTARTS);
+
+    bool GMM_BIC = params->getBoolFlag(ARG_GMM_BIC);
+    if (AUTO_BOUNDS) LOG.log("Compare GMM components by BIC:", GMM_BIC);
+
     int numThreads = params->getIntFlag(ARG_THREADS);
     argerr = argerr || checkThreads(numThreads);
+    if (argerr) return -1;
     LOG.log("Threads:", numThreads);
-*/
+    setBGZFThreads(numThreads);
+
     double error = params->getDoubleFlag(ARG_ERROR);
     argerr = argerr || checkError(error);
     if (argerr) return -1;
@@ -133,6 +213,20 @@ int main(int argc, char *argv[])
     if (KDE_SUBSAMPLE <= 0) LOG.log("# of rand individuals for KDE: ALL");
     else LOG.log("# of rand individuals for KDE:", KDE_SUBSAMPLE);
 
+    string KDE_ENGINE = params->getStringFlag(ARG_KDE_ENGINE);
+    argerr = argerr || checkKDEEngine(KDE_ENGINE);
+    if (argerr) return -1;
+    LOG.log("KDE engine:", KDE_ENGINE);
+    if (KDE_ENGINE.compare("fft") == 0) setKDEEngine(KDE_FFT);
+    else setKDEEngine(KDE_FIGTREE);
+
+    string KDE_BANDWIDTH = params->getStringFlag(ARG_KDE_BANDWIDTH);
+    argerr = argerr || checkKDEBandwidth(KDE_BANDWIDTH);
+    if (argerr) return -1;
+    LOG.log("KDE bandwidth:", KDE_BANDWIDTH);
+    if (KDE_BANDWIDTH.compare("sj") == 0) setKDEBandwidth(KDE_BW_SJ);
+    else setKDEBandwidth(KDE_BW_NRD0);
+
     bool RAW_LOD = params->getBoolFlag(ARG_RAW_LOD);
     LOG.log("Output raw LOD scores:", RAW_LOD);
 
@@ -142,7 +236,7 @@ int main(int argc, char *argv[])
     centromere *centro;
     centro = new centromere(BUILD, centromereFile, DEFAULT_CENTROMERE_FILE);
 
-    int numLoci, numInd, numCols;
+    int numLoci, numInd;
     vector< int_pair_t > *chrCoordList;
     vector< MapData * > *mapDataByChr;
     string popName;
@@ -151,39 +245,138 @@ int main(int argc, char *argv[])
     vector< FreqData * > *freqDataByChr;
     vector< WinData * > *winDataByChr;
     KDEResult *kdeResult;
+
+    //The missing data code only changes how a TPED is parsed
+    vector< string > sourceFiles;
+    char cacheMissing = TPED_MISSING;
+    if (VCF) sourceFiles.push_back(vcffile);
+    else if (BFILE)
+    {
+        sourceFiles.push_back(bfile + ".bed");
+        sourceFiles.push_back(bfile + ".bim");
+        sourceFiles.push_back(bfile + ".fam");
+    }
+    if (VCF || BFILE) cacheMissing = '\0';
+    else
+    {
+        sourceFiles.push_back(tpedfile);
+        sourceFiles.push_back(tfamfile);
+    }
+
     try
     {
-        chrCoordList = scanTPEDMapData(tpedfile, numLoci, numCols);
-        mapDataByChr = readTPEDMapData(tpedfile, numCols, chrCoordList, TPED_MISSING);
+        bool cached = CACHE && readGenotypeCache(cacheDir, sourceFiles, cacheMissing, &indData,
+                                                 &mapDataByChr, &hapDataByChr, &chrCoordList, numLoci);
+        if (cached)
+        {
+            numInd = indData->nind;
+            popName = indData->pop;
 
-        LOG.log("Total loci:", numLoci);
+            LOG.log("Population:", popName);
+            LOG.log("Total diploid individuals:", numInd);
+        }
+        else if (VCF)
+        {
+            readVCFData(vcffile, &indData, &mapDataByChr, &hapDataByChr, &chrCoordList, numLoci);
+            numInd = indData->nind;
+            popName = indData->pop;
+
+            LOG.log("Population:", popName);
+            LOG.log("Total diploid individuals:", numInd);
+        }
+        else
+        {
+            scanIndData3(tfamfile, numInd, popName);
+            indData = readIndData3(tfamfile, numInd);
+
+            LOG.log("Population:", popName);
+            LOG.log("Total diploid individuals:", numInd);
+
+            if (BFILE)
+            {
+                mapDataByChr = readBIMData(bfile + ".bim", &chrCoordList, numLoci);
+                hapDataByChr = readBEDData(bfile + ".bed", numInd, mapDataByChr);
+            }
+            else
+            {
+                readTPEDData(tpedfile, numInd, TPED_MISSING, numThreads, &mapDataByChr, &hapDataByChr, &chrCoordList, numLoci);
+            }
+        }
 
-        scanIndData3(tfamfile, numInd, popName);
-        indData = readIndData3(tfamfile, numInd);
 
-        LOG.log("Population:", popName);
-        LOG.log("Total diploid individuals:", numInd);
+        if (CACHE && !cached) writeGenotypeCache(cacheDir, sourceFiles, cacheMissing, indData, mapDataByChr, hapDataByChr);
 
-        hapDataByChr = readTPEDHapData3(tpedfile, numLoci, numInd, TPED_MISSING, mapDataByChr);
+        LOG.log("Total loci:", numLoci);
     }
     catch (...) { return 1; }
 
+//++++++++++Stage cache keys++++++++++
+    //With --cache, the frequencies and the window size and cutoff taken
+    //from the LOD score KDE are kept as well, and with --cache-windows the
+    //window scores, each keyed by the inputs and parameters it depends on
+    string dataKey = CACHE ? extendStageKey("input", "data", sourceFiles) : "";
+    dataKey = extendStageKey(dataKey, "tped-missing", string(1, cacheMissing));
+
+    string freqKey;
+    if (AUTO_FREQ) freqKey = extendStageKey(dataKey, "resample", nresample);
+    else
+    {
+        freqKey = extendStageKey(dataKey, "freq-file", vector< string >(1, freqfile));
+        freqKey = extendStageKey(freqKey, "pop", popName);
+    }
+
+    string lodKey = extendStageKey(freqKey, "error", error);
+    lodKey = extendStageKey(lodKey, "max-gap", MAX_GAP);
+    lodKey = extendStageKey(lodKey, "build", BUILD);
+    if (centromereFile.compare(DEFAULT_CENTROMERE_FILE) != 0)
+    {
+        lodKey = extendStageKey(lodKey, "centromere-file", vector< string >(1, centromereFile));
+    }
+
+    //Only window size exploration on its own skips the KDE stage, since
+    //it never goes on to call ROH
+    string kdeKey;
+    if (AUTO_WINSIZE || (AUTO_CUTOFF && !WINSIZE_EXPLORE))
+    {
+        kdeKey = extendStageKey(lodKey, "kde-engine", KDE_ENGINE);
+        kdeKey = extendStageKey(kdeKey, "kde-bw", KDE_BANDWIDTH);
+        kdeKey = extendStageKey(kdeKey, "kde-subsample", KDE_SUBSAMPLE);
+        kdeKey = extendStageKey(kdeKey, "auto-cutoff", string(AUTO_CUTOFF ? "1" : "0"));
+        kdeKey = extendStageKey(kdeKey, "auto-winsize", string(AUTO_WINSIZE ? "1" : "0"));
+        kdeKey = extendStageKey(kdeKey, "winsize", winsize);
+        if (AUTO_WINSIZE)
+        {
+            kdeKey = extendStageKey(kdeKey, "auto-winsize-step", AUTO_WINSIZE_STEP);
+            kdeKey = extendStageKey(kdeKey, "auto-winsize-search", AUTO_WINSIZE_SEARCH);
+            for (unsigned int i = 0; i < multiWinsizes.size(); i++)
+            {
+                kdeKey = extendStageKey(kdeKey, "winsize-multi", multiWinsizes[i]);
+            }
+        }
+    }
+
 //++++++++++Allele frequencies++++++++++
+    freqDataByChr = freqKey.empty() ? NULL : readFreqStage(cacheDir, freqKey, mapDataByChr);
+    bool freqCached = (freqDataByChr != NULL);
     if (AUTO_FREQ)
     {
-        cout << "Calculating allele frequencies\n";
-        freqDataByChr = calcFreqData2(hapDataByChr, nresample);
+        if (!freqCached)
+        {
+            cout << "Calculating allele frequencies\n";
+            freqDataByChr = calcFreqData2(hapDataByChr, nresample);
+        }
 
         string freqOutfile = outfile;
         freqOutfile += ".freq";
         writeFreqData(freqOutfile, popName, freqDataByChr, mapDataByChr, indData);
     }
-    else //(!AUTO_FREQ)
+    else if (!freqCached)
     {
         cout << "Loading user provided allele frequencies from " << freqfile << "\n";
-        try { freqDataByChr = readFreqData(freqfile, popName, chrCoordList, mapDataByChr); }
+        try { freqDataByChr = readFreqData(freqfile, popName, chrCoordList, mapDataByChr, FREQ_CACHE); }
         catch (...) { return -1; }
     }
+    if (!freqKey.empty() && !freqCached) writeFreqStage(cacheDir, freqKey, freqDataByChr);
     if (FREQ_ONLY) return 0;
 
     chrCoordList->clear();
@@ -202,69 +395,142 @@ int main(int argc, char *argv[])
 
     numLoci = newLoci;
 
+    //LOD score contributions only depend on the frequencies and error rate,
+    //so they are tabulated once and shared by every window size tried
+    vector< LODTable * > *lodTableByChr = initLODTable(freqDataByChr, error);
+    releaseFreqData(freqDataByChr);
+
+    ThreadPool *pool = initThreadPool(numThreads);
 
 //++++++++++Pipeline begins++++++++++
-    if (WINSIZE_EXPLORE && AUTO_WINSIZE)
-    {
-        kdeResult = selectWinsizeFromList(hapDataByChr, freqDataByChr, mapDataByChr,
-                                          indData, centro, &multiWinsizes, winsize, error,
-                                          MAX_GAP, KDE_SUBSAMPLE, outfile);
-    }
-    else if (WINSIZE_EXPLORE)
+    kde_stage_t kdeStage;
+    bool kdeCached = !kdeKey.empty() && readKDEStage(cacheDir, kdeKey, kdeStage);
+    if (kdeCached)
     {
-        /*
-        KDEWinsizeReport *winsizeReport =  calculateLODOverWinsizeRange(hapDataByChr, freqDataByChr,
-                                           mapDataByChr, indData, centro, &multiWinsizes, error, MAX_GAP,
-                                           KDE_SUBSAMPLE, numThreads, WINSIZE_EXPLORE, outfile);
-        releaseKDEWinsizeReport(winsizeReport);
-        */
-
-        exploreWinsizes(hapDataByChr, freqDataByChr, mapDataByChr,
-                        indData, centro, multiWinsizes, error,
-                        MAX_GAP, KDE_SUBSAMPLE, outfile);
-
-        return 0;
+        winsize = kdeStage.winsize;
+        if (AUTO_WINSIZE) LOG.log("Selected window size:", winsize);
+
+        string kdeOutfile = makeKDEFilename(outfile, winsize);
+        ofstream fout;
+        fout.open(kdeOutfile.c_str());
+        if (fout.fail())
+        {
+            LOG.err("ERROR: Failed to open", kdeOutfile);
+            return -1;
+        }
+        fout << kdeStage.kdeText;
+        fout.close();
     }
-    else if (AUTO_WINSIZE)
+    else if (WINSIZE_EXPLORE || AUTO_WINSIZE)
     {
-        try
+        //Running LOD totals are built in one pass over the genotypes of
+        //the individuals used for the KDE, after which every window size
+        //tried is scored by subtraction
+        vector< HapData * > *kdeHapDataByChr = hapDataByChr;
+        IndData *kdeIndData = indData;
+        if (KDE_SUBSAMPLE > 0) subsetData(hapDataByChr, indData, &kdeHapDataByChr, &kdeIndData, KDE_SUBSAMPLE);
+        vector< LODPrefix * > *lodPrefixByChr = calcLODPrefix(kdeHapDataByChr, lodTableByChr, mapDataByChr,
+                                                centro, MAX_GAP, pool);
+        if (KDE_SUBSAMPLE > 0) releaseHapData(kdeHapDataByChr);
+
+        if (WINSIZE_EXPLORE && AUTO_WINSIZE)
+        {
+            kdeResult = selectWinsizeFromList(lodPrefixByChr, mapDataByChr,
+                                              kdeIndData, &multiWinsizes, winsize,
+                                              outfile, pool);
+        }
+        else if (WINSIZE_EXPLORE)
         {
-            kdeResult = selectWinsize(hapDataByChr, freqDataByChr, mapDataByChr,
-                                      indData, centro, winsize, AUTO_WINSIZE_STEP, error,
-                                      MAX_GAP, KDE_SUBSAMPLE, outfile);
+            /*
+            KDEWinsizeReport *winsizeReport =  calculateLODOverWinsizeRange(hapDataByChr, freqDataByChr,
+                                               mapDataByChr, indData, centro, &multiWinsizes, error, MAX_GAP,
+                                               KDE_SUBSAMPLE, numThreads, WINSIZE_EXPLORE, outfile);
+            releaseKDEWinsizeReport(winsizeReport);
+            */
+
+            exploreWinsizes(lodPrefixByChr, mapDataByChr,
+                            kdeIndData, multiWinsizes,
+                            outfile, pool);
+
+            releaseLODPrefix(lodPrefixByChr);
+            releaseThreadPool(pool);
+            return 0;
         }
-        catch (...)
+        else
         {
-            return 1;
+            try
+            {
+                kdeResult = selectWinsize(lodPrefixByChr, mapDataByChr,
+                                          kdeIndData, winsize, AUTO_WINSIZE_STEP,
+                                          AUTO_WINSIZE_SEARCH.compare("bracket") == 0,
+                                          outfile, pool);
+            }
+            catch (...)
+            {
+                return 1;
+            }
+            /*
+            kdeResult = automaticallyChooseWindowSize(hapDataByChr, freqDataByChr, mapDataByChr,
+                        indData, centro, winsize, error, MAX_GAP, KDE_SUBSAMPLE, numThreads,
+                        WINSIZE_EXPLORE, AUTO_WINSIZE_THRESHOLD, outfile);
+                        */
+            LOG.log("Selected window size:", winsize);
         }
-        /*
-        kdeResult = automaticallyChooseWindowSize(hapDataByChr, freqDataByChr, mapDataByChr,
-                    indData, centro, winsize, error, MAX_GAP, KDE_SUBSAMPLE, numThreads,
-                    WINSIZE_EXPLORE, AUTO_WINSIZE_THRESHOLD, outfile);
-                    */
-        LOG.log("Selected window size:", winsize);
+
+        releaseLODPrefix(lodPrefixByChr);
+        if (KDE_SUBSAMPLE > 0) releaseIndData(kdeIndData);
     }
 
     cout << "Window size: " << winsize << endl;
 
-    winDataByChr = calcLODWindows(hapDataByChr, freqDataByChr, mapDataByChr,
-                                  indData, centro, winsize, error, MAX_GAP);
-
-    releaseHapData(hapDataByChr);
-    releaseFreqData(freqDataByChr);
-
+    //Raw LOD scores are always written from freshly scored windows, since
+    //the stage only keeps them in single precision
+    string winKey = CACHE_WINDOWS ? extendStageKey(lodKey, "winsize", winsize) : "";
+    WindowStage *winStage = NULL;
+    if (!winKey.empty() && !RAW_LOD) winStage = openWindowStage(cacheDir, winKey, mapDataByChr, indData);
+
+    //With a fixed window size the LOD score distribution for the cutoff
+    //is collected from a first pass over the windows
+    bool collectLODHist = (AUTO_CUTOFF && !AUTO_WINSIZE && !kdeCached);
+    LODHistogram *lodHist = NULL;
+    bool *kdeInd = NULL;
+    if (collectLODHist) kdeInd = selectKDEIndividuals(indData, KDE_SUBSAMPLE);
+
+    //Every window score is only held at once when they are written out.
+    //Otherwise windows are scored a block of individuals at a time, once
+    //for the distribution and once more while assembling ROH.
+    winDataByChr = NULL;
     if (RAW_LOD)
     {
+        vector< LODPrefix * > *lodPrefixByChr = calcLODPrefix(hapDataByChr, lodTableByChr, mapDataByChr,
+                                                centro, MAX_GAP, pool);
+        if (collectLODHist) lodHist = initLODHistogram();
+        winDataByChr = calcLODWindows(lodPrefixByChr, mapDataByChr,
+                                      indData, winsize, lodHist, kdeInd, pool);
+        releaseLODPrefix(lodPrefixByChr);
+
         //Output raw windows
         try { writeWinData(winDataByChr, indData, mapDataByChr, outfile); }
         catch (...) { return -1; }
+        if (!winKey.empty()) writeWindowStage(cacheDir, winKey, winDataByChr, mapDataByChr, indData);
     }
+    else if (collectLODHist)
+    {
+        lodHist = scanLODHistogram(hapDataByChr, lodTableByChr, mapDataByChr,
+                                   centro, winsize, MAX_GAP, kdeInd, pool);
+    }
+    if (kdeInd != NULL) delete [] kdeInd;
 
     if (AUTO_CUTOFF)
     {
-        if (!AUTO_WINSIZE && !WINSIZE_EXPLORE)
+        if (kdeCached)
+        {
+            LOD_CUTOFF = kdeStage.lodCutoff;
+        }
+        else if (collectLODHist)
         {
-            LOD_CUTOFF = selectLODCutoff(winDataByChr, indData, KDE_SUBSAMPLE, makeKDEFilename(outfile, winsize));
+            LOD_CUTOFF = selectLODCutoff(lodHist, makeKDEFilename(outfile, winsize));
+            releaseLODHistogram(lodHist);
         }
         else
         {
@@ -278,20 +544,55 @@ int main(int argc, char *argv[])
         cout << "User defined LOD score cutoff: " << LOD_CUTOFF << "\n";
     }
 
+    if (!kdeKey.empty() && !kdeCached)
+    {
+        string kdeOutfile = makeKDEFilename(outfile, winsize);
+        ifstream fin(kdeOutfile.c_str(), ios::in | ios::binary);
+        if (!fin.fail())
+        {
+            kdeStage.winsize = winsize;
+            kdeStage.lodCutoff = LOD_CUTOFF;
+            kdeStage.kdeText.assign(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+            writeKDEStage(cacheDir, kdeKey, kdeStage);
+        }
+    }
+
     cout << "Assembling ROH windows\n";
     //Assemble ROH for each individual in each pop
     ROHLength *rohLength;
-    vector< ROHData * > *rohDataByInd = assembleROHWindows(winDataByChr, mapDataByChr, indData,
-                                        centro, LOD_CUTOFF, &rohLength, winsize, MAX_GAP, OVERLAP_FRAC);
+    vector< ROHData * > *rohDataByInd;
+    if (winDataByChr != NULL)
+    {
+        rohDataByInd = assembleROHWindows(winDataByChr, mapDataByChr, indData,
+                                          centro, LOD_CUTOFF, &rohLength, winsize, MAX_GAP, OVERLAP_FRAC, pool);
+        releaseWinData(winDataByChr);
+    }
+    else if (winStage != NULL)
+    {
+        rohDataByInd = assembleROHScores(winStage->scoresByChr, mapDataByChr, indData,
+                                         centro, LOD_CUTOFF, &rohLength, winsize, MAX_GAP, OVERLAP_FRAC, pool);
+        releaseWindowStage(winStage);
+    }
+    else
+    {
+        //The window scores are kept as they are computed
+        winStage = winKey.empty() ? NULL : createWindowStage(cacheDir, winKey, mapDataByChr, indData);
+        rohDataByInd = scanROH(hapDataByChr, lodTableByChr, mapDataByChr, indData,
+                               centro, LOD_CUTOFF, &rohLength, winsize, MAX_GAP, OVERLAP_FRAC,
+                               (winStage != NULL) ? winStage->scoresByChr : NULL, pool);
+        commitWindowStage(winStage);
+        releaseWindowStage(winStage);
+    }
 
-    releaseWinData(winDataByChr);
+    releaseHapData(hapDataByChr);
+    releaseLODTable(lodTableByChr);
     delete centro;
     int_pair_t bounds;
 
     if (AUTO_BOUNDS)
     {
         cout << "Fitting 3-component GMM for size classification\n";
-        bounds = selectSizeClasses(rohLength);
+        bounds = selectSizeClasses(rohLength, GMM_BIN_WIDTH, GMM_RESTARTS, GMM_BIC, pool);
         LOG.log("Selected ROH size boundaries ( A/B, B/C ) = (", bounds.first, false);
         LOG.log(",", bounds.second, false);
         LOG.log(" )");
@@ -303,6 +604,8 @@ int main(int argc, char *argv[])
         cout << "User provided size boundaries.\n";
     }
 
+    releaseThreadPool(pool);
+
     cout << "ROH size boundaries ( A/B, B/C ) = ( " << bounds.first << ", " << bounds.second << " )\n";
 
     //Output ROH calls to file, one for each individual
@@ -9,126 +9,321 @@ bool inGap(int qStart, int qEnd, int targetStart, int targetEnd)
              (targetStart >= qStart && targetEnd <= qEnd) );
 }
 
-void calcLOD(IndData *indData, MapData *mapData,
-             HapData *hapData, FreqData *freqData,
-             WinData *winData, centromere *centro,
-             int winsize, double error, int MAX_GAP)
+//A window cannot be scored if the gap between two of its consecutive
+//loci is larger than MAX_GAP or touches the centromere.  segStart[locus]
+//is the first locus of the unbroken run containing locus, so the window
+//[s, s + winsize) is scored iff segStart[s + winsize - 1] <= s.
+static int *findLODSegments(MapData *mapData, centromere *centro, int MAX_GAP)
 {
-    short **data = hapData->data;
-    int nloci = hapData->nloci;
-    int nind = hapData->nind;
+    int nloci = mapData->nloci;
     int *physicalPos = mapData->physicalPos;
-    //double *geneticPos = mapData->geneticPos;
-    //string *locusName = mapData->locusName;
-    double *freq = freqData->freq;
-    int start = 0;
-    int stop = mapData->nloci;
-    double **win = winData->data;
-    //int nmiss = 0;
-
     int cStart = centro->centromereStart(mapData->chr);
     int cEnd = centro->centromereEnd(mapData->chr);
 
-    //Check if the last window would overshoot the last locus in the data
-    if (nloci - stop < winsize) stop = nloci - winsize + 1;
-
-    //For each individual
-    for (int ind = 0; ind < nind; ind++)
+    int *segStart = new int[nloci];
+    for (int locus = 0; locus < nloci; locus++)
     {
-        //starting locus of the window
-        for (int locus = start; locus < stop; locus++)
+        if (locus == 0 ||
+                physicalPos[locus] - physicalPos[locus - 1] > MAX_GAP ||
+                inGap(physicalPos[locus - 1], physicalPos[locus], cStart, cEnd))
         {
-            win[ind][locus] = 0;
+            segStart[locus] = locus;
+        }
+        else segStart[locus] = segStart[locus - 1];
+    }
+    return segStart;
+}
 
-            //First window?  If so we have to calcualte the whole thing
-            if (locus == start)
-            {
-                int prevI = locus;
-                for (int i = locus; i < locus + winsize; i++)
-                {
-                    if (physicalPos[i] - physicalPos[prevI] > MAX_GAP ||
-                            inGap(physicalPos[prevI], physicalPos[i], cStart, cEnd))
-                    {
-                        win[ind][locus] = MISSING;
-                        //nmiss++;
-                        locus = prevI;
-                        break;
-                    }
-                    win[ind][locus] += lod(data[i][ind], freq[i], error);
-                    prevI = i;
-                }
+//Cumulative LOD scores are built for a block of LOD_BLOCK_IND
+//individuals (one packed genotype word) at a time, walking the loci in
+//order so that each locus' genotypes are read once per block from a
+//single word.  Sums for LOD_BLOCK_LOCI consecutive loci are collected
+//in a small tile and then written out row by row.  Only the
+//individuals in words [firstWord, lastWord) are touched.
+static void calcLODPrefixBlock(HapData *hapData, LODTable *lodTable, LODPrefix *lodPrefix,
+                               int firstWord, int lastWord)
+{
+    int nind = hapData->nind;
+    int nloci = hapData->nloci;
+    double *lodByCode = lodTable->lod;
+    const int *segStart = lodPrefix->segStart;
 
-                //if(skip) continue;
+    double cur[LOD_BLOCK_IND];
+    double tile[LOD_BLOCK_LOCI][LOD_BLOCK_IND];
 
-            }
-            else //Otherwise, we can just subtract the locus that falls off and add the new one
+    for (int w = firstWord; w < lastWord; w++)
+    {
+        int firstInd = w * LOD_BLOCK_IND;
+        int blockInd = (nind - firstInd < LOD_BLOCK_IND) ? nind - firstInd : LOD_BLOCK_IND;
+
+        for (int tileStart = 0; tileStart < nloci; tileStart += LOD_BLOCK_LOCI)
+        {
+            int tileEnd = (nloci - tileStart < LOD_BLOCK_LOCI) ? nloci : tileStart + LOD_BLOCK_LOCI;
+            for (int locus = tileStart; locus < tileEnd; locus++)
             {
-                //But first we have to check if the previous window was MISSING
-                if (win[ind][locus - 1] != MISSING)
+                //Sums restart at every break, so they never grow past
+                //the length of one unbroken run
+                if (segStart[locus] == locus)
+                {
+                    for (int k = 0; k < LOD_BLOCK_IND; k++) cur[k] = 0;
+                }
+                uint64_t g = getHapLocus(hapData, locus)[w];
+                const double *t = lodByCode + 4 * locus;
+                double *out = tile[locus - tileStart];
+                for (int k = 0; k < LOD_BLOCK_IND; k++)
                 {
-                    //If the gap to the next locus is > MAX_GAP then make the window MISSING
-                    if (physicalPos[locus + winsize - 1] - physicalPos[locus + winsize - 2] > MAX_GAP ||
-                            inGap(physicalPos[locus + winsize - 2], physicalPos[locus + winsize - 1], cStart, cEnd))
-                    {
-                        win[ind][locus] = MISSING;
-                        //nmiss++;
-                        locus = locus + winsize - 2;
-                    }
-                    else
-                    {
-                        win[ind][locus] = win[ind][locus - 1] -
-                                          lod(data[locus - 1][ind], freq[locus - 1], error) +
-                                          lod(data[locus + winsize - 1][ind], freq[locus + winsize - 1], error);
-                    }
+                    cur[k] += t[(g >> (2 * k)) & 3];
+                    out[k] = cur[k];
                 }
-                else
+            }
+
+            for (int k = 0; k < blockInd; k++)
+            {
+                double *row = lodPrefix->sum[firstInd + k];
+                for (int locus = tileStart; locus < tileEnd; locus++)
                 {
-                    int prevI = locus;
-                    for (int i = locus; i < locus + winsize; i++)
-                    {
-                        if (physicalPos[i] - physicalPos[prevI] > MAX_GAP ||
-                                inGap(physicalPos[prevI], physicalPos[i], cStart, cEnd))
-                        {
-                            win[ind][locus] = MISSING;
-                            //nmiss++;
-                            locus = prevI;
-                            break;
-                        }
-                        win[ind][locus] += lod(data[i][ind], freq[i], error);
-                        prevI = i;
-                    }
-
-                    //if(skip) continue;
+                    row[locus] = tile[locus - tileStart][k];
                 }
             }
         }
     }
 
-    //winData->nmiss = nmiss;
+    return;
+}
+
+//Window scores for individuals [firstInd, lastInd) by subtraction.
+//Windows crossing a break keep the MISSING value from initWinData.
+//Scores are stored in winData and/or added to hist, for the individuals
+//flagged in histInd (all if NULL); either may be NULL.
+static void calcLODFromPrefix(LODPrefix *lodPrefix, WinData *winData, int winsize,
+                              int firstInd, int lastInd,
+                              LODHistogram *hist, const bool *histInd)
+{
+    const int *segStart = lodPrefix->segStart;
+    int stop = lodPrefix->nloci - winsize + 1;
 
+    for (int ind = firstInd; ind < lastInd; ind++)
+    {
+        const double *sum = lodPrefix->sum[ind];
+        double *win = (winData != NULL) ? winData->data[ind] : NULL;
+        bool addToHist = (hist != NULL && (histInd == NULL || histInd[ind]));
+        for (int locus = 0; locus < stop; locus++)
+        {
+            int last = locus + winsize - 1;
+            if (segStart[last] > locus) continue;
+            double score = (segStart[locus] == locus) ? sum[last] : sum[last] - sum[locus - 1];
+            if (win != NULL) win[locus] = score;
+            if (addToHist) addLODHistogram(hist, score);
+        }
+    }
+
+    return;
+}
+
+LODPrefix *initLODPrefix(MapData *mapData, centromere *centro, int nind, int MAX_GAP)
+{
+    LODPrefix *lodPrefix = new LODPrefix;
+    lodPrefix->nind = nind;
+    lodPrefix->nloci = mapData->nloci;
+    lodPrefix->segStart = findLODSegments(mapData, centro, MAX_GAP);
+    lodPrefix->sum = new double*[nind];
+    for (int ind = 0; ind < nind; ind++) lodPrefix->sum[ind] = new double[mapData->nloci];
+    return lodPrefix;
+}
+
+void releaseLODPrefix(LODPrefix *lodPrefix)
+{
+    if (lodPrefix == NULL) return;
+    for (int ind = 0; ind < lodPrefix->nind; ind++) delete [] lodPrefix->sum[ind];
+    delete [] lodPrefix->sum;
+    delete [] lodPrefix->segStart;
+    delete lodPrefix;
     return;
 }
 
-vector< WinData * > *calcLODWindows(vector< HapData * > *hapDataByChr,
-                                    vector< FreqData * > *freqDataByChr,
+void releaseLODPrefix(vector< LODPrefix * > *lodPrefixByChr)
+{
+    for (unsigned int chr = 0; chr < lodPrefixByChr->size(); chr++)
+    {
+        releaseLODPrefix(lodPrefixByChr->at(chr));
+    }
+    lodPrefixByChr->clear();
+    delete lodPrefixByChr;
+    return;
+}
+
+LODPrefix *calcLODPrefix(MapData *mapData, HapData *hapData, LODTable *lodTable,
+                         centromere *centro, int MAX_GAP)
+{
+    LODPrefix *lodPrefix = initLODPrefix(mapData, centro, hapData->nind, MAX_GAP);
+    calcLODPrefixBlock(hapData, lodTable, lodPrefix, 0, hapData->wordsPerLocus);
+    return lodPrefix;
+}
+
+void calcLOD(LODPrefix *lodPrefix, WinData *winData, int winsize, LODHistogram *hist)
+{
+    calcLODFromPrefix(lodPrefix, winData, winsize, 0, lodPrefix->nind, hist, NULL);
+    return;
+}
+
+//One (chromosome, block of individuals) unit of work for calcLODPrefix
+//and calcLODWindows.  Blocks are whole genotype words in the first and
+//the corresponding individuals in the second.
+struct lod_task_t
+{
+    HapData *hapData;
+    LODTable *lodTable;
+    LODPrefix *lodPrefix;
+    WinData *winData;
+    LODHistogram *hist;
+    const bool *histInd;
+    int winsize;
+    int first;
+    int last;
+    double cost;
+};
+
+static void runLODPrefixTask(void *arg)
+{
+    lod_task_t *task = (lod_task_t *)arg;
+    calcLODPrefixBlock(task->hapData, task->lodTable, task->lodPrefix, task->first, task->last);
+    return;
+}
+
+static void runLODWindowTask(void *arg)
+{
+    lod_task_t *task = (lod_task_t *)arg;
+    calcLODFromPrefix(task->lodPrefix, task->winData, task->winsize, task->first, task->last,
+                      task->hist, task->histInd);
+    return;
+}
+
+static bool largerLODTask(const lod_task_t *a, const lod_task_t *b)
+{
+    return a->cost > b->cost;
+}
+
+//Chromosomes are cut into blocks of individuals so that there are about
+//LOD_TASKS_PER_THREAD tasks per thread, and the biggest tasks are
+//scheduled first.  Tasks write disjoint rows and fill their own
+//histograms, which are merged into hist in task order.
+static void runLODTasks(vector< lod_task_t * > &lodTasks, void (*run)(void *),
+                        LODHistogram *hist, ThreadPool *pool)
+{
+    stable_sort(lodTasks.begin(), lodTasks.end(), largerLODTask);
+
+    vector< pool_task_t > tasks;
+    for (unsigned int i = 0; i < lodTasks.size(); i++)
+    {
+        pool_task_t task;
+        task.run = run;
+        task.arg = (void *)lodTasks[i];
+        tasks.push_back(task);
+    }
+    runThreadPool(pool, tasks);
+
+    for (unsigned int i = 0; i < lodTasks.size(); i++)
+    {
+        if (lodTasks[i]->hist != NULL)
+        {
+            mergeLODHistogram(hist, lodTasks[i]->hist);
+            releaseLODHistogram(lodTasks[i]->hist);
+        }
+        delete lodTasks[i];
+    }
+    lodTasks.clear();
+    return;
+}
+
+static int lodUnitsPerTask(int nunits, int nchr, ThreadPool *pool)
+{
+    int numThreads = (pool->numThreads > 1) ? pool->numThreads : 1;
+    int unitsPerTask = (nunits * nchr) / (LOD_TASKS_PER_THREAD * numThreads);
+    if (unitsPerTask < 1) unitsPerTask = 1;
+    if (unitsPerTask > nunits) unitsPerTask = nunits;
+    return unitsPerTask;
+}
+
+vector< LODPrefix * > *calcLODPrefix(vector< HapData * > *hapDataByChr,
+                                     vector< LODTable * > *lodTableByChr,
+                                     vector< MapData * > *mapDataByChr,
+                                     centromere *centro, int MAX_GAP,
+                                     ThreadPool *pool)
+{
+    vector< LODPrefix * > *lodPrefixByChr = new vector< LODPrefix * >;
+
+    int nchr = hapDataByChr->size();
+    int nwords = hapDataByChr->at(0)->wordsPerLocus;
+    int wordsPerTask = lodUnitsPerTask(nwords, nchr, pool);
+
+    vector< lod_task_t * > lodTasks;
+    for (int chr = 0; chr < nchr; chr++)
+    {
+        HapData *hapData = hapDataByChr->at(chr);
+        LODPrefix *lodPrefix = initLODPrefix(mapDataByChr->at(chr), centro, hapData->nind, MAX_GAP);
+        lodPrefixByChr->push_back(lodPrefix);
+        for (int w = 0; w < nwords; w += wordsPerTask)
+        {
+            lod_task_t *task = new lod_task_t;
+            task->hapData = hapData;
+            task->lodTable = lodTableByChr->at(chr);
+            task->lodPrefix = lodPrefix;
+            task->winData = NULL;
+            task->hist = NULL;
+            task->histInd = NULL;
+            task->winsize = 0;
+            task->first = w;
+            task->last = (w + wordsPerTask < nwords) ? w + wordsPerTask : nwords;
+            task->cost = double(hapData->nloci) * (task->last - task->first);
+            lodTasks.push_back(task);
+        }
+    }
+    runLODTasks(lodTasks, runLODPrefixTask, NULL, pool);
+
+    return lodPrefixByChr;
+}
+
+//If hist is given the window scores of the individuals flagged in
+//histInd (all if NULL) are also added to it
+vector< WinData * > *calcLODWindows(vector< LODPrefix * > *lodPrefixByChr,
                                     vector< MapData * > *mapDataByChr,
                                     IndData *indData,
-                                    centromere *centro,
-                                    int winsize, double error, int MAX_GAP)
+                                    int winsize,
+                                    LODHistogram *hist, const bool *histInd,
+                                    ThreadPool *pool)
 {
     vector< WinData * > *winDataByChr = initWinData(mapDataByChr, indData);
 
-    for (unsigned int chr = 0; chr < winDataByChr->size(); chr++)
+    int nchr = winDataByChr->size();
+    int nind = indData->nind;
+    int blocksPerTask = lodUnitsPerTask(hapWordsPerLocus(nind), nchr, pool);
+    int indPerTask = blocksPerTask * LOD_BLOCK_IND;
+
+    vector< lod_task_t * > lodTasks;
+    for (int chr = 0; chr < nchr; chr++)
     {
-        calcLOD(indData, mapDataByChr->at(chr),
-                hapDataByChr->at(chr), freqDataByChr->at(chr),
-                winDataByChr->at(chr), centro,
-                winsize, error, MAX_GAP);
+        int stop = lodPrefixByChr->at(chr)->nloci - winsize + 1;
+        for (int ind = 0; ind < nind && stop > 0; ind += indPerTask)
+        {
+            lod_task_t *task = new lod_task_t;
+            task->hapData = NULL;
+            task->lodTable = NULL;
+            task->lodPrefix = lodPrefixByChr->at(chr);
+            task->winData = winDataByChr->at(chr);
+            task->hist = (hist != NULL) ? initLODHistogram() : NULL;
+            task->histInd = histInd;
+            task->winsize = winsize;
+            task->first = ind;
+            task->last = (ind + indPerTask < nind) ? ind + indPerTask : nind;
+            task->cost = double(stop) * (task->last - task->first);
+            lodTasks.push_back(task);
+        }
     }
+    runLODTasks(lodTasks, runLODWindowTask, hist, pool);
+
     return winDataByChr;
 }
 
-
 /*
  * Genotype is 0/1/2 counting the number of alternate alleles
  *
@@ -166,6 +361,52 @@ double lod(const short &genotype, const double &freq, const double &error)
     return log10(autozygous / nonAutozygous);
 }
 
+//Tabulates lod() for each genotype code at each locus of a chromosome
+LODTable *initLODTable(FreqData *freqData, double error)
+{
+    LODTable *lodTable = new LODTable;
+    lodTable->nloci = freqData->nloci;
+    lodTable->lod = new double[4 * freqData->nloci];
+    for (int locus = 0; locus < freqData->nloci; locus++)
+    {
+        double freq = freqData->freq[locus];
+        lodTable->lod[4 * locus] = lod(0, freq, error);
+        lodTable->lod[4 * locus + 1] = lod(1, freq, error);
+        lodTable->lod[4 * locus + 2] = lod(2, freq, error);
+        lodTable->lod[4 * locus + 3] = lod(-9, freq, error);
+    }
+    return lodTable;
+}
+
+vector< LODTable * > *initLODTable(vector< FreqData * > *freqDataByChr, double error)
+{
+    vector< LODTable * > *lodTableByChr = new vector< LODTable * >;
+    for (unsigned int chr = 0; chr < freqDataByChr->size(); chr++)
+    {
+        lodTableByChr->push_back(initLODTable(freqDataByChr->at(chr), error));
+    }
+    return lodTableByChr;
+}
+
+void releaseLODTable(LODTable *lodTable)
+{
+    if (lodTable == NULL) return;
+    delete [] lodTable->lod;
+    delete lodTable;
+    return;
+}
+
+void releaseLODTable(vector< LODTable * > *lodTableByChr)
+{
+    for (unsigned int chr = 0; chr < lodTableByChr->size(); chr++)
+    {
+        releaseLODTable(lodTableByChr->at(chr));
+    }
+    lodTableByChr->clear();
+    delete lodTableByChr;
+    return;
+}
+
 vector< ROHData * > *initROHData(IndData *indData)
 {
     vector< ROHData * > *rohDataByInd = new vector< ROHData * >;
@@ -187,7 +428,153 @@ void releaseROHData(vector< ROHData * > *rohDataByInd)
     delete rohDataByInd;
 }
 
-vector< ROHData * > *assembleROHWindows(vector< WinData * > *winDataByChr,
+//One block of individuals for assembleROHWindows or
+//assembleROHScores.  ROH lengths are collected per task and
+//concatenated in task order afterwards.
+struct roh_task_t
+{
+    vector< WinData * > *winDataByChr;
+    vector< float * > *scoresByChr;
+    vector< MapData * > *mapDataByChr;
+    vector< ROHData * > *rohDataByInd;
+    centromere *centro;
+    double lodScoreCutoff;
+    int winSize;
+    int MAX_GAP;
+    double OVERLAP_THRESHOLD;
+    int firstInd;
+    int lastInd;
+    vector<int> lengths;
+};
+
+//The number of windows above the cutoff covering each locus is kept as
+//a difference array: +1 where such a window starts and -1 one past its
+//end, so coverage is a running sum and the cost does not depend on the
+//window size.  inWinDiff is scratch space for nloci + 1 ints.
+static void assembleROHChr(const double *win, MapData *mapData, centromere *centro,
+                           double lodScoreCutoff, int winSize, int MAX_GAP,
+                           double OVERLAP_THRESHOLD, int *inWinDiff,
+                           ROHData *rohData, int chr, vector<int> &lengths)
+{
+    int cStart = centro->centromereStart(mapData->chr);
+    int cEnd = centro->centromereEnd(mapData->chr);
+
+    //translation of the perl script here###Updated to match trevor's algorithm
+    int nloci = mapData->nloci;
+    for (int w = 0; w <= nloci; w++) inWinDiff[w] = 0;
+    for (int w = 0; w < nloci; w++)
+    {
+        if (win[w] >= lodScoreCutoff)
+        {
+            inWinDiff[w]++;
+            inWinDiff[(w + winSize < nloci) ? w + winSize : nloci]--;
+        }
+    }
+
+    int winStart = -1;
+    int winStop = -1;
+    int inWin = 0;
+    for (int w = 0; w < nloci; w++)
+    {
+        inWin += inWinDiff[w];
+        //No window being extended and the snp is in ROH
+        //Start the window
+        if (winStart < 0 && inWin >= OVERLAP_THRESHOLD)
+        {
+            winStart = mapData->physicalPos[w];
+        }
+        //Window being extended and snp is not in ROH
+        //end the window at w-1
+        //reset winStart to -1
+        else if (inWin >= OVERLAP_THRESHOLD && (mapData->physicalPos[w] - mapData->physicalPos[w - 1] > MAX_GAP ||
+                 inGap(mapData->physicalPos[w - 1], mapData->physicalPos[w], cStart, cEnd)) ) {
+            winStop = mapData->physicalPos[w - 1];
+            int size = winStop - winStart + 1;
+            lengths.push_back(size);
+            rohData->chr.push_back(chr);
+            rohData->start.push_back(winStart);
+            rohData->stop.push_back(winStop);
+            winStop = -1;
+            winStart = mapData->physicalPos[w];
+        }
+        else if (winStart > 0 && ! (inWin >= OVERLAP_THRESHOLD) )
+        {
+            winStop = mapData->physicalPos[w - 1];
+            int size = winStop - winStart + 1;
+            lengths.push_back(size);
+            rohData->chr.push_back(chr);
+            rohData->start.push_back(winStart);
+            rohData->stop.push_back(winStop);
+            winStart = -1;
+            winStop = -1;
+        }
+        else if (winStart > 0 && w + 1 >= nloci)
+        {
+            winStop = mapData->physicalPos[w];
+            int size = winStop - winStart + 1;
+            lengths.push_back(size);
+            rohData->chr.push_back(chr);
+            rohData->start.push_back(winStart);
+            rohData->stop.push_back(winStop);
+            winStart = -1;
+            winStop = -1;
+        }
+    }
+
+    return;
+}
+
+static int maxLociByChr(vector< MapData * > *mapDataByChr)
+{
+    int maxLoci = 0;
+    for (unsigned int chr = 0; chr < mapDataByChr->size(); chr++)
+    {
+        if (mapDataByChr->at(chr)->nloci > maxLoci) maxLoci = mapDataByChr->at(chr)->nloci;
+    }
+    return maxLoci;
+}
+
+//One scratch array serves every chromosome and individual in the block.
+//Single precision scores are widened a row at a time into winRow.
+static void runROHTask(void *arg)
+{
+    roh_task_t *task = (roh_task_t *)arg;
+    int maxLoci = maxLociByChr(task->mapDataByChr);
+    int *inWinDiff = new int[maxLoci + 1];
+    double *winRow = (task->scoresByChr != NULL) ? new double[maxLoci] : NULL;
+
+    for (int ind = task->firstInd; ind < task->lastInd; ind++)
+    {
+        for (unsigned int chr = 0; chr < task->mapDataByChr->size(); chr++)
+        {
+            const double *win;
+            if (task->scoresByChr != NULL)
+            {
+                int nloci = task->mapDataByChr->at(chr)->nloci;
+                const float *scores = task->scoresByChr->at(chr) + (size_t)ind * nloci;
+                for (int locus = 0; locus < nloci; locus++) winRow[locus] = scores[locus];
+                win = winRow;
+            }
+            else win = task->winDataByChr->at(chr)->data[ind];
+
+            assembleROHChr(win, task->mapDataByChr->at(chr),
+                           task->centro, task->lodScoreCutoff, task->winSize, task->MAX_GAP,
+                           task->OVERLAP_THRESHOLD, inWinDiff, task->rohDataByInd->at(ind),
+                           chr, task->lengths);
+        }
+    }
+
+    delete [] inWinDiff;
+    if (winRow != NULL) delete [] winRow;
+    return;
+}
+
+//Individuals are assembled in parallel blocks.  Each individual's
+//ROHData is only touched by its own task and the lengths are gathered
+//in individual order, so the output does not depend on the number of
+//threads.  Scores come from winDataByChr or, if it is NULL, scoresByChr.
+static vector< ROHData * > *assembleROH(vector< WinData * > *winDataByChr,
+                                        vector< float * > *scoresByChr,
                                         vector< MapData * > *mapDataByChr,
                                         IndData *indData,
                                         centromere *centro,
@@ -195,7 +582,8 @@ vector< ROHData * > *assembleROHWindows(vector< WinData * > *winDataByChr,
                                         ROHLength **rohLength,
                                         int winSize,
                                         int MAX_GAP,
-                                        double OVERLAP_FRAC)
+                                        double OVERLAP_FRAC,
+                                        ThreadPool *pool)
 {
     vector<int> lengths;
     vector< ROHData * > *rohDataByInd = initROHData(indData);
@@ -203,88 +591,330 @@ vector< ROHData * > *assembleROHWindows(vector< WinData * > *winDataByChr,
     double OVERLAP_THRESHOLD = OVERLAP_FRAC * winSize;
     OVERLAP_THRESHOLD = (OVERLAP_THRESHOLD >= 1) ? OVERLAP_THRESHOLD : 1;
 
-    for (int ind = 0; ind < indData->nind; ind++)
+    int nind = indData->nind;
+    for (int ind = 0; ind < nind; ind++) rohDataByInd->at(ind)->indID = indData->indID[ind];
+
+    int numThreads = (pool->numThreads > 1) ? pool->numThreads : 1;
+    int indPerTask = nind / (LOD_TASKS_PER_THREAD * numThreads);
+    if (indPerTask < 1) indPerTask = 1;
+
+    vector< roh_task_t * > rohTasks;
+    vector< pool_task_t > tasks;
+    for (int ind = 0; ind < nind; ind += indPerTask)
     {
-        ROHData *rohData = rohDataByInd->at(ind);
-        rohData->indID = indData->indID[ind];
+        roh_task_t *task = new roh_task_t;
+        task->winDataByChr = winDataByChr;
+        task->scoresByChr = (winDataByChr == NULL) ? scoresByChr : NULL;
+        task->mapDataByChr = mapDataByChr;
+        task->rohDataByInd = rohDataByInd;
+        task->centro = centro;
+        task->lodScoreCutoff = lodScoreCutoff;
+        task->winSize = winSize;
+        task->MAX_GAP = MAX_GAP;
+        task->OVERLAP_THRESHOLD = OVERLAP_THRESHOLD;
+        task->firstInd = ind;
+        task->lastInd = (ind + indPerTask < nind) ? ind + indPerTask : nind;
+        rohTasks.push_back(task);
+
+        pool_task_t poolTask;
+        poolTask.run = runROHTask;
+        poolTask.arg = (void *)task;
+        tasks.push_back(poolTask);
+    }
+    runThreadPool(pool, tasks);
 
-        for (unsigned int chr = 0; chr < winDataByChr->size(); chr++)
+    for (unsigned int i = 0; i < rohTasks.size(); i++)
+    {
+        lengths.insert(lengths.end(), rohTasks[i]->lengths.begin(), rohTasks[i]->lengths.end());
+        delete rohTasks[i];
+    }
+
+    ROHLength *rohLengths = initROHLength(lengths.size(), indData->pop);
+    for (unsigned int i = 0; i < lengths.size(); i++)
+    {
+        rohLengths->length[i] = lengths[i];
+    }
+    (*rohLength) = rohLengths;
+
+    return rohDataByInd;
+}
+
+vector< ROHData * > *assembleROHWindows(vector< WinData * > *winDataByChr,
+                                        vector< MapData * > *mapDataByChr,
+                                        IndData *indData,
+                                        centromere *centro,
+                                        double lodScoreCutoff,
+                                        ROHLength **rohLength,
+                                        int winSize,
+                                        int MAX_GAP,
+                                        double OVERLAP_FRAC,
+                                        ThreadPool *pool)
+{
+    return assembleROH(winDataByChr, NULL, mapDataByChr, indData, centro, lodScoreCutoff,
+                       rohLength, winSize, MAX_GAP, OVERLAP_FRAC, pool);
+}
+
+vector< ROHData * > *assembleROHScores(vector< float * > *scoresByChr,
+                                       vector< MapData * > *mapDataByChr,
+                                       IndData *indData,
+                                       centromere *centro,
+                                       double lodScoreCutoff,
+                                       ROHLength **rohLength,
+                                       int winSize,
+                                       int MAX_GAP,
+                                       double OVERLAP_FRAC,
+                                       ThreadPool *pool)
+{
+    return assembleROH(NULL, scoresByChr, mapDataByChr, indData, centro, lodScoreCutoff,
+                       rohLength, winSize, MAX_GAP, OVERLAP_FRAC, pool);
+}
+
+//One block of genotype words for scanLODHistogram and scanROH.  Running
+//LOD totals are rebuilt one word (LOD_BLOCK_IND individuals) and one
+//chromosome at a time in scratch space, so neither the totals nor the
+//window scores of the whole sample are ever held at once.
+struct scan_task_t
+{
+    vector< HapData * > *hapDataByChr;
+    vector< LODTable * > *lodTableByChr;
+    vector< MapData * > *mapDataByChr;
+    vector< int * > *segStartByChr;
+    int winsize;
+    int firstWord;
+    int lastWord;
+
+    //Phase 1, the window score distribution
+    LODHistogram *hist;
+    const bool *histInd;
+
+    //Phase 2, ROH assembly
+    vector< ROHData * > *rohDataByInd;
+    centromere *centro;
+    double lodScoreCutoff;
+    int MAX_GAP;
+    double OVERLAP_THRESHOLD;
+
+    //If given, window scores are also copied here in single precision,
+    //one block of nind rows per chromosome
+    vector< float * > *winOutByChr;
+};
+
+static bool wordHasFlaggedInd(const bool *histInd, int w, int nind)
+{
+    if (histInd == NULL) return true;
+    int lastInd = (w + 1) * LOD_BLOCK_IND;
+    if (lastInd > nind) lastInd = nind;
+    for (int ind = w * LOD_BLOCK_IND; ind < lastInd; ind++)
+    {
+        if (histInd[ind]) return true;
+    }
+    return false;
+}
+
+//The scratch LODPrefix and WinData have a row pointer for every
+//individual, but rows only exist for the current word (and, for the
+//windows, the current individual).
+static void runScanTask(void *arg)
+{
+    scan_task_t *task = (scan_task_t *)arg;
+    int nind = task->hapDataByChr->at(0)->nind;
+    int maxLoci = maxLociByChr(task->mapDataByChr);
+    bool assemble = (task->rohDataByInd != NULL);
+
+    double *sumRows = new double[LOD_BLOCK_IND * maxLoci];
+    LODPrefix blockPrefix;
+    blockPrefix.nind = nind;
+    blockPrefix.sum = new double*[nind];
+
+    double *winRow = NULL;
+    int *inWinDiff = NULL;
+    vector<int> lengths;
+    WinData blockWin;
+    blockWin.nind = nind;
+    blockWin.data = NULL;
+    if (assemble)
+    {
+        winRow = new double[maxLoci];
+        inWinDiff = new int[maxLoci + 1];
+        blockWin.data = new double*[nind];
+    }
+
+    for (int w = task->firstWord; w < task->lastWord; w++)
+    {
+        if (!assemble && !wordHasFlaggedInd(task->histInd, w, nind)) continue;
+
+        int firstInd = w * LOD_BLOCK_IND;
+        int lastInd = (firstInd + LOD_BLOCK_IND < nind) ? firstInd + LOD_BLOCK_IND : nind;
+        for (int ind = firstInd; ind < lastInd; ind++)
+        {
+            blockPrefix.sum[ind] = sumRows + (ind - firstInd) * maxLoci;
+        }
+
+        for (unsigned int chr = 0; chr < task->hapDataByChr->size(); chr++)
         {
-            WinData *winData = winDataByChr->at(chr);
-            MapData *mapData = mapDataByChr->at(chr);
-
-            int cStart = centro->centromereStart(mapData->chr);
-            int cEnd = centro->centromereEnd(mapData->chr);
-
-            //translation of the perl script here###Updated to match trevor's algorithm
-            //int winStart = -1;
-            //int winStop = -1;
-            short *inWin = new short[mapData->nloci];
-            for (int w = 0; w < mapData->nloci; w++) inWin[w] = 0;
-            for (int w = 0; w < winData->nloci; w++)
+            int nloci = task->mapDataByChr->at(chr)->nloci;
+            blockPrefix.nloci = nloci;
+            blockPrefix.segStart = task->segStartByChr->at(chr);
+            calcLODPrefixBlock(task->hapDataByChr->at(chr), task->lodTableByChr->at(chr), &blockPrefix, w, w + 1);
+
+            if (!assemble)
             {
-                if (winData->data[ind][w] >= lodScoreCutoff)
-                {
-                    for (int i = 0; i < winSize; i++) inWin[w + i]++;
-                }
+                calcLODFromPrefix(&blockPrefix, NULL, task->winsize, firstInd, lastInd,
+                                  task->hist, task->histInd);
+                continue;
             }
 
-            int winStart = -1;
-            int winStop = -1;
-            for (int w = 0; w < mapData->nloci; w++)
+            blockWin.nloci = nloci;
+            for (int ind = firstInd; ind < lastInd; ind++)
             {
-                //No window being extended and the snp is in ROH
-                //Start the window
-                if (winStart < 0 && inWin[w] >= OVERLAP_THRESHOLD)
-                {
-                    winStart = mapData->physicalPos[w];
-                }
-                //Window being extended and snp is not in ROH
-                //end the window at w-1
-                //reset winStart to -1
-                else if (inWin[w] >= OVERLAP_THRESHOLD && (mapData->physicalPos[w] - mapData->physicalPos[w - 1] > MAX_GAP ||
-                         inGap(mapData->physicalPos[w - 1], mapData->physicalPos[w], cStart, cEnd)) ) {
-                    winStop = mapData->physicalPos[w - 1];
-                    int size = winStop - winStart + 1;
-                    lengths.push_back(size);
-                    rohData->chr.push_back(chr);
-                    rohData->start.push_back(winStart);
-                    rohData->stop.push_back(winStop);
-                    winStop = -1;
-                    winStart = mapData->physicalPos[w];
-                }
-                else if (winStart > 0 && ! (inWin[w] >= OVERLAP_THRESHOLD) )
-                {
-                    winStop = mapData->physicalPos[w - 1];
-                    int size = winStop - winStart + 1;
-                    lengths.push_back(size);
-                    rohData->chr.push_back(chr);
-                    rohData->start.push_back(winStart);
-                    rohData->stop.push_back(winStop);
-                    winStart = -1;
-                    winStop = -1;
-                }
-                else if (winStart > 0 && w + 1 >= mapData->nloci)
+                for (int locus = 0; locus < nloci; locus++) winRow[locus] = MISSING;
+                blockWin.data[ind] = winRow;
+                calcLODFromPrefix(&blockPrefix, &blockWin, task->winsize, ind, ind + 1, NULL, NULL);
+                if (task->winOutByChr != NULL)
                 {
-                    winStop = mapData->physicalPos[w];
-                    int size = winStop - winStart + 1;
-                    lengths.push_back(size);
-                    rohData->chr.push_back(chr);
-                    rohData->start.push_back(winStart);
-                    rohData->stop.push_back(winStop);
-                    winStart = -1;
-                    winStop = -1;
+                    float *scores = task->winOutByChr->at(chr) + (size_t)ind * nloci;
+                    for (int locus = 0; locus < nloci; locus++) scores[locus] = winRow[locus];
                 }
+                assembleROHChr(winRow, task->mapDataByChr->at(chr), task->centro,
+                               task->lodScoreCutoff, task->winsize, task->MAX_GAP,
+                               task->OVERLAP_THRESHOLD, inWinDiff,
+                               task->rohDataByInd->at(ind), chr, lengths);
             }
+        }
+    }
+
+    delete [] sumRows;
+    delete [] blockPrefix.sum;
+    if (assemble)
+    {
+        delete [] winRow;
+        delete [] inWinDiff;
+        delete [] blockWin.data;
+    }
+    return;
+}
 
-            delete [] inWin;
+//Words are dealt out in blocks, about LOD_TASKS_PER_THREAD per thread.
+//hist, if given, receives the per-task histograms in task order.
+static void runScanTasks(scan_task_t &proto, LODHistogram *hist, centromere *centro,
+                         int MAX_GAP, ThreadPool *pool)
+{
+    vector< int * > segStartByChr;
+    for (unsigned int chr = 0; chr < proto.mapDataByChr->size(); chr++)
+    {
+        segStartByChr.push_back(findLODSegments(proto.mapDataByChr->at(chr), centro, MAX_GAP));
+    }
+    proto.segStartByChr = &segStartByChr;
+
+    int nwords = proto.hapDataByChr->at(0)->wordsPerLocus;
+    int wordsPerTask = lodUnitsPerTask(nwords, 1, pool);
+
+    vector< scan_task_t * > scanTasks;
+    vector< pool_task_t > tasks;
+    for (int w = 0; w < nwords; w += wordsPerTask)
+    {
+        scan_task_t *task = new scan_task_t(proto);
+        task->hist = (hist != NULL) ? initLODHistogram() : NULL;
+        task->firstWord = w;
+        task->lastWord = (w + wordsPerTask < nwords) ? w + wordsPerTask : nwords;
+        scanTasks.push_back(task);
+
+        pool_task_t poolTask;
+        poolTask.run = runScanTask;
+        poolTask.arg = (void *)task;
+        tasks.push_back(poolTask);
+    }
+    runThreadPool(pool, tasks);
+
+    for (unsigned int i = 0; i < scanTasks.size(); i++)
+    {
+        if (scanTasks[i]->hist != NULL)
+        {
+            mergeLODHistogram(hist, scanTasks[i]->hist);
+            releaseLODHistogram(scanTasks[i]->hist);
         }
+        delete scanTasks[i];
     }
+    for (unsigned int chr = 0; chr < segStartByChr.size(); chr++) delete [] segStartByChr[chr];
+    return;
+}
 
-    ROHLength *rohLengths = initROHLength(lengths.size(), indData->pop);
-    for (unsigned int i = 0; i < lengths.size(); i++)
+LODHistogram *scanLODHistogram(vector< HapData * > *hapDataByChr,
+                               vector< LODTable * > *lodTableByChr,
+                               vector< MapData * > *mapDataByChr,
+                               centromere *centro,
+                               int winsize,
+                               int MAX_GAP,
+                               const bool *histInd,
+                               ThreadPool *pool)
+{
+    LODHistogram *hist = initLODHistogram();
+
+    scan_task_t proto;
+    proto.hapDataByChr = hapDataByChr;
+    proto.lodTableByChr = lodTableByChr;
+    proto.mapDataByChr = mapDataByChr;
+    proto.winsize = winsize;
+    proto.histInd = histInd;
+    proto.rohDataByInd = NULL;
+    proto.centro = centro;
+    proto.lodScoreCutoff = 0;
+    proto.MAX_GAP = MAX_GAP;
+    proto.OVERLAP_THRESHOLD = 0;
+    proto.winOutByChr = NULL;
+    runScanTasks(proto, hist, centro, MAX_GAP, pool);
+
+    return hist;
+}
+
+//Gives the same ROH and lengths as assembleROHWindows on the output of
+//calcLODWindows.  Lengths are read back from the ROH in individual
+//order once every task is done.  If winOutByChr is given, the window
+//scores are also left there in single precision.
+vector< ROHData * > *scanROH(vector< HapData * > *hapDataByChr,
+                             vector< LODTable * > *lodTableByChr,
+                             vector< MapData * > *mapDataByChr,
+                             IndData *indData,
+                             centromere *centro,
+                             double lodScoreCutoff,
+                             ROHLength **rohLength,
+                             int winSize,
+                             int MAX_GAP,
+                             double OVERLAP_FRAC,
+                             vector< float * > *winOutByChr,
+                             ThreadPool *pool)
+{
+    vector< ROHData * > *rohDataByInd = initROHData(indData);
+    for (int ind = 0; ind < indData->nind; ind++) rohDataByInd->at(ind)->indID = indData->indID[ind];
+
+    double OVERLAP_THRESHOLD = OVERLAP_FRAC * winSize;
+    OVERLAP_THRESHOLD = (OVERLAP_THRESHOLD >= 1) ? OVERLAP_THRESHOLD : 1;
+
+    scan_task_t proto;
+    proto.hapDataByChr = hapDataByChr;
+    proto.lodTableByChr = lodTableByChr;
+    proto.mapDataByChr = mapDataByChr;
+    proto.winsize = winSize;
+    proto.histInd = NULL;
+    proto.rohDataByInd = rohDataByInd;
+    proto.centro = centro;
+    proto.lodScoreCutoff = lodScoreCutoff;
+    proto.MAX_GAP = MAX_GAP;
+    proto.OVERLAP_THRESHOLD = OVERLAP_THRESHOLD;
+    proto.winOutByChr = winOutByChr;
+    runScanTasks(proto, NULL, centro, MAX_GAP, pool);
+
+    int size = 0;
+    for (int ind = 0; ind < indData->nind; ind++) size += rohDataByInd->at(ind)->start.size();
+    ROHLength *rohLengths = initROHLength(size, indData->pop);
+    int i = 0;
+    for (int ind = 0; ind < indData->nind; ind++)
     {
-        rohLengths->length[i] = lengths[i];
+        ROHData *rohData = rohDataByInd->at(ind);
+        for (unsigned int roh = 0; roh < rohData->start.size(); roh++)
+        {
+            rohLengths->length[i++] = rohData->stop[roh] - rohData->start[roh] + 1;
+        }
     }
     (*rohLength) = rohLengths;
 
@@ -384,20 +1014,29 @@ double selectLODCutoff(KDEResult *kdeResult)
 }
 
 
-double selectLODCutoff(vector< WinData * > *winDataByChr, IndData *indData, int KDE_SUBSAMPLE, string kdeoutfile)
+//Individuals whose window scores go into the KDE, NULL for all
+bool *selectKDEIndividuals(IndData *indData, int KDE_SUBSAMPLE)
 {
-    //Format the LOD window data into a single array per pop with no missing data
-    //Prepped for KDE
-    DoubleData *rawWinData;
-    double LOD_CUTOFF;
+    if (KDE_SUBSAMPLE <= 0) return NULL;
 
-    if (KDE_SUBSAMPLE <= 0) rawWinData = convertWinData2DoubleData(winDataByChr);
-    else rawWinData = convertSubsetWinData2DoubleData(winDataByChr, indData, KDE_SUBSAMPLE);
+    IndData *subsetIndData;
+    int *randInd = selectSubsample(indData, KDE_SUBSAMPLE, &subsetIndData);
+    bool *kdeInd = new bool[indData->nind];
+    for (int ind = 0; ind < indData->nind; ind++) kdeInd[ind] = false;
+    for (int ind = 0; ind < subsetIndData->nind; ind++) kdeInd[randInd[ind]] = true;
+
+    delete [] randInd;
+    releaseIndData(subsetIndData);
+    return kdeInd;
+}
+
+double selectLODCutoff(LODHistogram *hist, string kdeoutfile)
+{
+    double LOD_CUTOFF;
 
     //Compute KDE of LOD score distribution
     cout << "Estimating distribution of raw LOD score windows:\n";
-    KDEResult *kdeResult = computeKDE(rawWinData->data, rawWinData->size);
-    releaseDoubleData(rawWinData);
+    KDEResult *kdeResult = computeKDE(hist);
 
     //Output kde points
     try { writeKDEResult(kdeResult, kdeoutfile); }
@@ -617,193 +1256,592 @@ void compute(void *order)
     return;
 }
 */
-void exploreWinsizes(vector< HapData * > *hapDataByChr,
-                     vector< FreqData * > *freqDataByChr,
-                     vector< MapData * > *mapDataByChr,
-                     IndData *indData,
-                     centromere *centro,
-                     vector<int> &multiWinsizes,
-                     double error,
-                     int MAX_GAP, int KDE_SUBSAMPLE, string outfile)
+//One candidate window size for exploreWinsizes and the window size
+//searches.  Each task scores its own windows and runs its own KDE, so
+//several sizes can be evaluated at once.
+struct winsize_task_t
 {
-    vector< WinData * > *winDataByChr;
-    vector< HapData * > *hapDataByChrToCalc;
-    IndData *indDataToCalc;
+    vector< LODPrefix * > *lodPrefixByChr;
+    vector< MapData * > *mapDataByChr;
+    IndData *indData;
+    int winsize;
+    bool wiggle;
+    KDEResult *kdeResult;
+    double mse;
+};
 
-    if (KDE_SUBSAMPLE > 0) subsetData(hapDataByChr, indData, &hapDataByChrToCalc, &indDataToCalc, KDE_SUBSAMPLE);
-    else
+//The pool is busy running the candidates, so each one scores its
+//chromosomes on its own thread.  Only the distribution of the scores is
+//needed, so they go straight into a histogram.
+static void runWinsizeTask(void *arg)
+{
+    winsize_task_t *task = (winsize_task_t *)arg;
+    LODHistogram *hist = initLODHistogram();
+    for (unsigned int chr = 0; chr < task->lodPrefixByChr->size(); chr++)
     {
-        hapDataByChrToCalc = hapDataByChr;
-        indDataToCalc = indData;
+        calcLOD(task->lodPrefixByChr->at(chr), NULL, task->winsize, hist);
     }
 
-    for (unsigned int i = 0; i < multiWinsizes.size(); i++)
-    {
-        winDataByChr = calcLODWindows(hapDataByChrToCalc, freqDataByChr, mapDataByChr,
-                                      indDataToCalc, centro, multiWinsizes[i],
-                                      error, MAX_GAP);
+    task->kdeResult = computeKDE(hist);
+    releaseLODHistogram(hist);
 
-        DoubleData *rawWinData = convertWinData2DoubleData(winDataByChr);
-        releaseWinData(winDataByChr);
+    if (task->wiggle) task->mse = calculateWiggle(task->kdeResult);
+    return;
+}
 
-        KDEResult *kdeResult = computeKDE(rawWinData->data, rawWinData->size);
-        releaseDoubleData(rawWinData);
+//Evaluates the given window sizes concurrently, one per thread
+static vector< winsize_task_t * > *evaluateWinsizes(vector< LODPrefix * > *lodPrefixByChr,
+        vector< MapData * > *mapDataByChr,
+        IndData *indData,
+        const vector<int> &winsizes,
+        bool wiggle,
+        ThreadPool *pool)
+{
+    vector< winsize_task_t * > *winsizeTasks = new vector< winsize_task_t * >;
+    vector< pool_task_t > tasks;
+    for (unsigned int i = 0; i < winsizes.size(); i++)
+    {
+        winsize_task_t *task = new winsize_task_t;
+        task->lodPrefixByChr = lodPrefixByChr;
+        task->mapDataByChr = mapDataByChr;
+        task->indData = indData;
+        task->winsize = winsizes[i];
+        task->wiggle = wiggle;
+        task->kdeResult = NULL;
+        task->mse = 0;
+        winsizeTasks->push_back(task);
+
+        pool_task_t poolTask;
+        poolTask.run = runWinsizeTask;
+        poolTask.arg = (void *)task;
+        tasks.push_back(poolTask);
+    }
+    runThreadPool(pool, tasks);
+    return winsizeTasks;
+}
 
-        try { writeKDEResult(kdeResult, makeKDEFilename(outfile, multiWinsizes[i])); }
-        catch (...) { throw 0; }
+static void releaseWinsizeTasks(vector< winsize_task_t * > *winsizeTasks)
+{
+    for (unsigned int i = 0; i < winsizeTasks->size(); i++)
+    {
+        releaseKDEResult(winsizeTasks->at(i)->kdeResult);
+        delete winsizeTasks->at(i);
     }
+    winsizeTasks->clear();
+    delete winsizeTasks;
+    return;
+}
 
-    if (KDE_SUBSAMPLE > 0) {
-        releaseHapData(hapDataByChrToCalc);
-        releaseIndData(indDataToCalc);
+static int winsizeBatchSize(ThreadPool *pool)
+{
+    return (pool->numThreads > 1) ? pool->numThreads : 1;
+}
+
+void exploreWinsizes(vector< LODPrefix * > *lodPrefixByChr,
+                     vector< MapData * > *mapDataByChr,
+                     IndData *indData,
+                     vector<int> &multiWinsizes,
+                     string outfile,
+                     ThreadPool *pool)
+{
+    int batchSize = winsizeBatchSize(pool);
+    for (unsigned int first = 0; first < multiWinsizes.size(); first += batchSize)
+    {
+        vector<int> batch;
+        for (unsigned int i = first; i < multiWinsizes.size() && i < first + batchSize; i++)
+        {
+            batch.push_back(multiWinsizes[i]);
+        }
+        vector< winsize_task_t * > *winsizeTasks = evaluateWinsizes(lodPrefixByChr, mapDataByChr,
+                indData, batch, false, pool);
+
+        for (unsigned int i = 0; i < winsizeTasks->size(); i++)
+        {
+            try { writeKDEResult(winsizeTasks->at(i)->kdeResult, makeKDEFilename(outfile, winsizeTasks->at(i)->winsize)); }
+            catch (...) { throw 0; }
+        }
+        releaseWinsizeTasks(winsizeTasks);
     }
 
-    hapDataByChrToCalc = NULL;
-    indDataToCalc = NULL;
     return;
 }
 
+//Logs a finished candidate and returns whether it is smooth enough
+static bool winsizePasses(winsize_task_t *task, double AUTO_WINSIZE_THRESHOLD)
+{
+    LOG.logn(task->winsize);
+    LOG.logn("\t");
+    LOG.log(task->mse);
+    return (task->mse <= AUTO_WINSIZE_THRESHOLD);
+}
+
+//Candidate sizes are evaluated one batch per round, a batch holding one
+//size per thread.  Results are checked in order of size, so the
+//smallest passing size is selected as with one size at a time.
+static int linearWinsizeSearch(vector< LODPrefix * > *lodPrefixByChr,
+                               vector< MapData * > *mapDataByChr,
+                               IndData *indData,
+                               int winsize, int step,
+                               double AUTO_WINSIZE_THRESHOLD,
+                               KDEResult **selectedKDEResult,
+                               ThreadPool *pool)
+{
+    int batchSize = winsizeBatchSize(pool);
+    int winsizeQuery = winsize;
+    while (*selectedKDEResult == NULL)
+    {
+        vector<int> batch;
+        for (int i = 0; i < batchSize; i++) batch.push_back(winsizeQuery + i * step);
+        vector< winsize_task_t * > *winsizeTasks = evaluateWinsizes(lodPrefixByChr, mapDataByChr,
+                indData, batch, true, pool);
+
+        for (unsigned int i = 0; i < winsizeTasks->size(); i++)
+        {
+            if (winsizePasses(winsizeTasks->at(i), AUTO_WINSIZE_THRESHOLD))
+            {
+                *selectedKDEResult = cloneKDEResult(winsizeTasks->at(i)->kdeResult);
+                winsize = winsizeTasks->at(i)->winsize;
+                break;
+            }
+        }
+        releaseWinsizeTasks(winsizeTasks);
+        winsizeQuery += batchSize * step;
+    }
+    return winsize;
+}
+
+//Window sizes are winsize + k * step.  The number of steps k is doubled
+//until a size passes, and the interval between the last failing and the
+//first passing k is then narrowed down to a single step.  Each round
+//probes one k per thread, spread evenly over the open interval, which
+//is plain bisection with one thread.
+static int bracketWinsizeSearch(vector< LODPrefix * > *lodPrefixByChr,
+                                vector< MapData * > *mapDataByChr,
+                                IndData *indData,
+                                int winsize, int step,
+                                double AUTO_WINSIZE_THRESHOLD,
+                                KDEResult **selectedKDEResult,
+                                ThreadPool *pool)
+{
+    int batchSize = winsizeBatchSize(pool);
+    int lo = -1;
+    int hi = -1;
+    int nextK = 0;
+    while (hi < 0 || hi - lo > 1)
+    {
+        vector<int> ks;
+        if (hi < 0)
+        {
+            for (int i = 0; i < batchSize; i++)
+            {
+                ks.push_back(nextK);
+                nextK = (nextK == 0) ? 1 : 2 * nextK;
+            }
+        }
+        else
+        {
+            int span = hi - lo;
+            int nprobe = (span - 1 < batchSize) ? span - 1 : batchSize;
+            for (int i = 1; i <= nprobe; i++)
+            {
+                int k = lo + (int)((long(span) * i) / (nprobe + 1));
+                if (ks.size() == 0 || k > ks.back()) ks.push_back(k);
+            }
+        }
+
+        vector<int> batch;
+        for (unsigned int i = 0; i < ks.size(); i++) batch.push_back(winsize + ks[i] * step);
+        vector< winsize_task_t * > *winsizeTasks = evaluateWinsizes(lodPrefixByChr, mapDataByChr,
+                indData, batch, true, pool);
+
+        for (unsigned int i = 0; i < winsizeTasks->size(); i++)
+        {
+            if (winsizePasses(winsizeTasks->at(i), AUTO_WINSIZE_THRESHOLD))
+            {
+                hi = ks[i];
+                if (*selectedKDEResult != NULL) releaseKDEResult(*selectedKDEResult);
+                *selectedKDEResult = cloneKDEResult(winsizeTasks->at(i)->kdeResult);
+                break;
+            }
+            lo = ks[i];
+        }
+        releaseWinsizeTasks(winsizeTasks);
+    }
+    return winsize + hi * step;
+}
 
-KDEResult *selectWinsize(vector< HapData * > *hapDataByChr,
-                         vector< FreqData * > *freqDataByChr,
+KDEResult *selectWinsize(vector< LODPrefix * > *lodPrefixByChr,
                          vector< MapData * > *mapDataByChr,
-                         IndData *indData, centromere *centro,
-                         int &winsize, int step, double error,
-                         int MAX_GAP, int KDE_SUBSAMPLE, string outfile)
+                         IndData *indData,
+                         int &winsize, int step, bool bracket,
+                         string outfile,
+                         ThreadPool *pool)
 {
     double AUTO_WINSIZE_THRESHOLD = 0.5;
-    vector< WinData * > *winDataByChr = NULL;
-    vector< HapData * > *hapDataByChrToCalc = NULL;
-    IndData *indDataToCalc = NULL;
     KDEResult *selectedKDEResult = NULL;
 
-    //subset of individuals as given by --kde-subsample
-    if (KDE_SUBSAMPLE > 0) subsetData(hapDataByChr, indData, &hapDataByChrToCalc, &indDataToCalc, KDE_SUBSAMPLE);
+    LOG.log("Searching for acceptable window size, smoothness threshold:", AUTO_WINSIZE_THRESHOLD);
+    LOG.log("winsize\tsmoothness");
+
+    if (bracket)
+    {
+        winsize = bracketWinsizeSearch(lodPrefixByChr, mapDataByChr, indData,
+                                       winsize, step, AUTO_WINSIZE_THRESHOLD, &selectedKDEResult, pool);
+    }
     else
     {
-        hapDataByChrToCalc = hapDataByChr;
-        indDataToCalc = indData;
+        winsize = linearWinsizeSearch(lodPrefixByChr, mapDataByChr, indData,
+                                      winsize, step, AUTO_WINSIZE_THRESHOLD, &selectedKDEResult, pool);
     }
 
+    try { writeKDEResult(selectedKDEResult, makeKDEFilename(outfile, winsize)); }
+    catch (...) { throw 0; }
+
+    return selectedKDEResult;
+}
+
+KDEResult *selectWinsizeFromList(vector< LODPrefix * > *lodPrefixByChr,
+                                 vector< MapData * > *mapDataByChr,
+                                 IndData *indData,
+                                 vector<int> *multiWinsizes, int &winsize,
+                                 string outfile,
+                                 ThreadPool *pool)
+{
+    double AUTO_WINSIZE_THRESHOLD = 0.5;
+    KDEResult *selectedKDEResult = NULL;
+
     LOG.log("Searching for acceptable window size, smoothness threshold:", AUTO_WINSIZE_THRESHOLD);
     LOG.log("winsize\tsmoothness");
 
-    int winsizeQuery = winsize;
-    double mse;
+    int batchSize = winsizeBatchSize(pool);
     bool finished = false;
-    while (!finished)
+    for (unsigned int first = 0; first < multiWinsizes->size() && !finished; first += batchSize)
     {
-        winDataByChr = calcLODWindows(hapDataByChrToCalc, freqDataByChr, mapDataByChr,
-                                      indDataToCalc, centro, winsizeQuery,
-                                      error, MAX_GAP);
+        vector<int> batch;
+        for (unsigned int i = first; i < multiWinsizes->size() && i < first + batchSize; i++)
+        {
+            batch.push_back(multiWinsizes->at(i));
+        }
+        vector< winsize_task_t * > *winsizeTasks = evaluateWinsizes(lodPrefixByChr, mapDataByChr,
+                indData, batch, true, pool);
 
-        DoubleData *rawWinData = convertWinData2DoubleData(winDataByChr);
-        releaseWinData(winDataByChr);
+        for (unsigned int i = 0; i < winsizeTasks->size() && !finished; i++)
+        {
+            winsize_task_t *task = winsizeTasks->at(i);
+            if (winsizePasses(task, AUTO_WINSIZE_THRESHOLD) || first + i == multiWinsizes->size() - 1)
+            {
+                finished = true;
+                selectedKDEResult = cloneKDEResult(task->kdeResult);
+                winsize = task->winsize;
+                try { writeKDEResult(selectedKDEResult, makeKDEFilename(outfile, winsize)); }
+                catch (...) { throw 0; }
+            }
+        }
+        releaseWinsizeTasks(winsizeTasks);
+    }
 
-        KDEResult *kdeResult = computeKDE(rawWinData->data, rawWinData->size);
-        releaseDoubleData(rawWinData);
+    return selectedKDEResult;
+}
 
-        mse = calculateWiggle(kdeResult);
-        LOG.logn(winsizeQuery);
-        LOG.logn("\t");
-        LOG.log(mse);
+//Collapses the lengths into bins of binWidth bp, each represented by
+//the middle of the integer lengths it holds and weighted by its count.
+//With a width of 1 this just merges identical lengths.  Returns the
+//number of bins.
+static int binROHLengths(ROHLength *rohLength, int binWidth, double **value, double **weight)
+{
+    vector<long> bins(rohLength->size);
+    for (int i = 0; i < rohLength->size; i++)
+    {
+        bins[i] = (long)floor(rohLength->length[i] / double(binWidth));
+    }
+    sort(bins.begin(), bins.end());
 
-        if (mse <= AUTO_WINSIZE_THRESHOLD)
+    vector<double> binValue;
+    vector<double> binWeight;
+    for (unsigned int i = 0; i < bins.size(); i++)
+    {
+        if (i == 0 || bins[i] != bins[i - 1])
         {
-            finished = true;
-            selectedKDEResult = cloneKDEResult(kdeResult);
-            winsize = winsizeQuery;
-            try { writeKDEResult(selectedKDEResult, makeKDEFilename(outfile, winsize)); }
-            catch (...) { throw 0; }
+            binValue.push_back(double(bins[i]) * binWidth + (binWidth - 1) / 2.0);
+            binWeight.push_back(0);
         }
-        else winsizeQuery += step;
-        releaseKDEResult(kdeResult);
+        binWeight.back()++;
     }
 
-    if (KDE_SUBSAMPLE > 0) {
-        releaseHapData(hapDataByChrToCalc);
-        releaseIndData(indDataToCalc);
+    int nbins = binValue.size();
+    *value = new double[nbins];
+    *weight = new double[nbins];
+    for (int i = 0; i < nbins; i++)
+    {
+        (*value)[i] = binValue[i];
+        (*weight)[i] = binWeight[i];
     }
-
-    hapDataByChrToCalc = NULL;
-    indDataToCalc = NULL;
-
-    return selectedKDEResult;
+    return nbins;
 }
 
-KDEResult *selectWinsizeFromList(vector< HapData * > *hapDataByChr,
-                                 vector< FreqData * > *freqDataByChr,
-                                 vector< MapData * > *mapDataByChr,
-                                 IndData *indData, centromere *centro,
-                                 vector<int> *multiWinsizes, int &winsize, double error,
-                                 int MAX_GAP, int KDE_SUBSAMPLE, string outfile)
+//k-means++ seeding in one dimension: the first centre is drawn with
+//probability proportional to weight and each further one proportional
+//to weight times the squared distance to the nearest centre so far.
+//Each point then goes to its nearest centre, and the clusters give the
+//starting proportions, means and variances.  Clusters too small to
+//have a variance start with var / k.
+static void kmeansppInit(double *x, double *weight, int n, int k, const gsl_rng *r,
+                         double var, double *W, double *Mu, double *Sigma)
 {
-    double AUTO_WINSIZE_THRESHOLD = 0.5;
-    vector< WinData * > *winDataByChr = NULL;
-    vector< HapData * > *hapDataByChrToCalc = NULL;
-    IndData *indDataToCalc = NULL;
-    KDEResult *selectedKDEResult = NULL;
+    double *d2 = new double[n];
+    for (int j = 0; j < n; j++) d2[j] = 1;
 
-    //subset of individuals as given by --kde-subsample
-    if (KDE_SUBSAMPLE > 0) subsetData(hapDataByChr, indData, &hapDataByChrToCalc, &indDataToCalc, KDE_SUBSAMPLE);
-    else
+    for (int c = 0; c < k; c++)
     {
-        hapDataByChrToCalc = hapDataByChr;
-        indDataToCalc = indData;
+        double total = 0;
+        for (int j = 0; j < n; j++) total += d2[j] * ((weight != NULL) ? weight[j] : 1.0);
+
+        int pick = 0;
+        if (total > 0)
+        {
+            double u = gsl_rng_uniform(r) * total;
+            double cum = 0;
+            for (pick = 0; pick < n - 1; pick++)
+            {
+                cum += d2[pick] * ((weight != NULL) ? weight[pick] : 1.0);
+                if (cum > u) break;
+            }
+        }
+        Mu[c] = x[pick];
+
+        for (int j = 0; j < n; j++)
+        {
+            double d = (x[j] - Mu[c]) * (x[j] - Mu[c]);
+            if (c == 0 || d < d2[j]) d2[j] = d;
+        }
+    }
+    delete [] d2;
+
+    double *sw = new double[k];
+    double *swx = new double[k];
+    double *swx2 = new double[k];
+    for (int c = 0; c < k; c++) sw[c] = swx[c] = swx2[c] = 0;
+    double total = 0;
+    for (int j = 0; j < n; j++)
+    {
+        int best = 0;
+        for (int c = 1; c < k; c++)
+        {
+            if (fabs(x[j] - Mu[c]) < fabs(x[j] - Mu[best])) best = c;
+        }
+        double w = (weight != NULL) ? weight[j] : 1.0;
+        sw[best] += w;
+        swx[best] += w * x[j];
+        swx2[best] += w * x[j] * x[j];
+        total += w;
     }
 
-    LOG.log("Searching for acceptable window size, smoothness threshold:", AUTO_WINSIZE_THRESHOLD);
-    LOG.log("winsize\tsmoothness");
+    double sumW = 0;
+    for (int c = 0; c < k; c++)
+    {
+        W[c] = (sw[c] > 0) ? sw[c] / total : 1.0 / double(n);
+        sumW += W[c];
+        if (sw[c] > 0) Mu[c] = swx[c] / sw[c];
+        Sigma[c] = (sw[c] > 1) ? swx2[c] / sw[c] - Mu[c] * Mu[c] : 0;
+        if (!(Sigma[c] > 0)) Sigma[c] = var / double(k);
+    }
+    for (int c = 0; c < k; c++) W[c] /= sumW;
 
-    double mse;
-    for (unsigned int i = 0; i < multiWinsizes->size(); i++)
+    delete [] sw;
+    delete [] swx;
+    delete [] swx2;
+    return;
+}
+
+//One EM run for fitGMM.  W, Mu and Sigma hold the starting values, or
+//are filled by k-means++ when seed is non-zero, and receive the fit.
+struct gmm_start_t
+{
+    double *x;
+    double *weight;
+    int n;
+    int ngaussians;
+    double var;
+    unsigned long seed;
+    double *W;
+    double *Mu;
+    double *Sigma;
+    double loglikelihood;
+    double BIC;
+};
+
+static void runGMMStart(void *arg)
+{
+    gmm_start_t *start = (gmm_start_t *)arg;
+    if (start->seed != 0)
     {
-        winDataByChr = calcLODWindows(hapDataByChrToCalc, freqDataByChr, mapDataByChr,
-                                      indDataToCalc, centro, multiWinsizes->at(i),
-                                      error, MAX_GAP);
+        gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+        gsl_rng_set(r, start->seed);
+        kmeansppInit(start->x, start->weight, start->n, start->ngaussians, r,
+                     start->var, start->W, start->Mu, start->Sigma);
+        gsl_rng_free(r);
+    }
 
-        DoubleData *rawWinData = convertWinData2DoubleData(winDataByChr);
-        releaseWinData(winDataByChr);
+    GMM gmm(start->ngaussians, start->W, start->Mu, start->Sigma, GMM_MAX_ITER, GMM_TOLERANCE, false);
+    gmm.estimate(start->x, start->weight, start->n);
+    for (int k = 0; k < start->ngaussians; k++)
+    {
+        start->W[k] = gmm.getMixCoefficient(k);
+        start->Mu[k] = gmm.getMean(k);
+        start->Sigma[k] = gmm.getVar(k);
+    }
+    start->loglikelihood = gmm.getLogLikelihood();
+    start->BIC = gmm.getBIC();
+    return;
+}
 
-        KDEResult *kdeResult = computeKDE(rawWinData->data, rawWinData->size);
-        releaseDoubleData(rawWinData);
+//Fits an ngaussians component GMM into W, Mu and Sigma and returns its
+//BIC.  The first start spreads the components over the mean mu and
+//variance var of the lengths.  With restarts > 0 that many more starts
+//are seeded by k-means++, all starts run concurrently (each on one
+//thread), and the fit with the highest finite log likelihood is kept.
+static double fitGMM(double *x, double *weight, int n, int ngaussians,
+                     int restarts, double mu, double var,
+                     double *W, double *Mu, double *Sigma, ThreadPool *pool)
+{
+    for (int k = 0; k < ngaussians; k++)
+    {
+        W[k] = 1.0 / double(ngaussians);
+        Mu[k] = mu * double(k + 1) / double(ngaussians + 1);
+        Sigma[k] = var * (k + 1) / double(ngaussians);
+    }
+
+    if (restarts <= 0)
+    {
+        GMM gmm(ngaussians, W, Mu, Sigma, GMM_MAX_ITER, GMM_TOLERANCE, true);
+        gmm.setThreadPool(pool);
+        gmm.estimate(x, weight, n);
+        for (int k = 0; k < ngaussians; k++)
+        {
+            W[k] = gmm.getMixCoefficient(k);
+            Mu[k] = gmm.getMean(k);
+            Sigma[k] = gmm.getVar(k);
+        }
+        return gmm.getBIC();
+    }
 
-        mse = calculateWiggle(kdeResult);
-        LOG.logn(multiWinsizes->at(i));
-        LOG.logn("\t");
-        LOG.log(mse);
+    gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
+    gsl_rng_set(r, time(NULL));
 
-        if (mse <= AUTO_WINSIZE_THRESHOLD || i == multiWinsizes->size() - 1)
+    int nstarts = restarts + 1;
+    gmm_start_t *starts = new gmm_start_t[nstarts];
+    vector< pool_task_t > tasks;
+    for (int i = 0; i < nstarts; i++)
+    {
+        starts[i].x = x;
+        starts[i].weight = weight;
+        starts[i].n = n;
+        starts[i].ngaussians = ngaussians;
+        starts[i].var = var;
+        starts[i].seed = 0;
+        while (i > 0 && starts[i].seed == 0) starts[i].seed = gsl_rng_get(r);
+        starts[i].W = new double[ngaussians];
+        starts[i].Mu = new double[ngaussians];
+        starts[i].Sigma = new double[ngaussians];
+        for (int k = 0; k < ngaussians; k++)
         {
-            selectedKDEResult = cloneKDEResult(kdeResult);
-            winsize = multiWinsizes->at(i);
-            try { writeKDEResult(selectedKDEResult, makeKDEFilename(outfile, winsize)); }
-            catch (...) { throw 0; }
-            releaseKDEResult(kdeResult);
-            break;
+            starts[i].W[k] = W[k];
+            starts[i].Mu[k] = Mu[k];
+            starts[i].Sigma[k] = Sigma[k];
         }
-        releaseKDEResult(kdeResult);
+
+        pool_task_t task;
+        task.run = runGMMStart;
+        task.arg = (void *)(&starts[i]);
+        tasks.push_back(task);
     }
+    gsl_rng_free(r);
+    runThreadPool(pool, tasks);
 
-    if (KDE_SUBSAMPLE > 0) {
-        releaseHapData(hapDataByChrToCalc);
-        releaseIndData(indDataToCalc);
+    int best = -1;
+    for (int i = 0; i < nstarts; i++)
+    {
+        LOG.log("GMM start", i, false);
+        LOG.log(" log likelihood:", starts[i].loglikelihood);
+        if (!gsl_finite(starts[i].loglikelihood)) continue;
+        if (best < 0 || starts[i].loglikelihood > starts[best].loglikelihood) best = i;
     }
+    if (best < 0) best = 0;
+    LOG.log("Best GMM start:", best);
 
-    hapDataByChrToCalc = NULL;
-    indDataToCalc = NULL;
+    for (int k = 0; k < ngaussians; k++)
+    {
+        W[k] = starts[best].W[k];
+        Mu[k] = starts[best].Mu[k];
+        Sigma[k] = starts[best].Sigma[k];
+    }
+    double BIC = starts[best].BIC;
 
-    return selectedKDEResult;
+    for (int i = 0; i < nstarts; i++)
+    {
+        delete [] starts[i].W;
+        delete [] starts[i].Mu;
+        delete [] starts[i].Sigma;
+    }
+    delete [] starts;
+    return BIC;
 }
 
-int_pair_t selectSizeClasses(ROHLength *rohLength)
+//Logs the BIC of fits with 1 to GMM_BIC_MAX_COMPONENTS components.  The
+//size classes are always taken from the 3 component fit, which is
+//returned in W3, Mu3 and Sigma3, so this only reports whether the
+//lengths support a different number of classes.
+static void compareGMMComponents(double *x, double *weight, int n, int restarts,
+                                 double mu, double var,
+                                 double *W3, double *Mu3, double *Sigma3, ThreadPool *pool)
+{
+    double *W = new double[GMM_BIC_MAX_COMPONENTS];
+    double *Mu = new double[GMM_BIC_MAX_COMPONENTS];
+    double *Sigma = new double[GMM_BIC_MAX_COMPONENTS];
+
+    cout << "Comparing GMM component counts by BIC\n";
+    int bestK = 0;
+    double bestBIC = 0;
+    for (int k = 1; k <= GMM_BIC_MAX_COMPONENTS; k++)
+    {
+        double BIC = fitGMM(x, weight, n, k, restarts, mu, var, W, Mu, Sigma, pool);
+        LOG.log("GMM components", k, false);
+        LOG.log(" BIC:", BIC);
+        if (k == 3)
+        {
+            for (int i = 0; i < k; i++)
+            {
+                W3[i] = W[i];
+                Mu3[i] = Mu[i];
+                Sigma3[i] = Sigma[i];
+            }
+        }
+        if (gsl_finite(BIC) && (bestK == 0 || BIC < bestBIC))
+        {
+            bestK = k;
+            bestBIC = BIC;
+        }
+    }
+    LOG.log("GMM components preferred by BIC:", bestK);
+    cout << "GMM components preferred by BIC: " << bestK << endl;
+    if (bestK != 3)
+    {
+        LOG.err("WARNING: Size classes are taken from 3 GMM components, but BIC prefers", bestK);
+    }
+
+    delete [] W;
+    delete [] Mu;
+    delete [] Sigma;
+    return;
+}
+
+int_pair_t selectSizeClasses(ROHLength *rohLength, int binWidth, int restarts, bool compareBIC,
+                             ThreadPool *pool)
 {
     int_pair_t bounds;
     size_t *sortIndex;
 
     int ngaussians = 3;
-    size_t maxIter = 1000;
-    double tolerance = 1e-5;
     double * W;
     double * Mu;
     double * Sigma;
@@ -816,25 +1854,27 @@ int_pair_t selectSizeClasses(ROHLength *rohLength)
     //calculate mean and var for the population size distribution to use for initial guess
     double var = gsl_stats_variance(rohLength->length, 1, rohLength->size);
     double mu = gsl_stats_mean(rohLength->length, 1, rohLength->size);
-    for (int n = 0; n < ngaussians; n++)
+
+    double *x = rohLength->length;
+    double *weight = NULL;
+    int n = rohLength->size;
+    if (binWidth > 0)
     {
-        W[n] = 1.0 / double(ngaussians);
-        Mu[n] = mu * double(n + 1) / double(ngaussians + 1);
-        Sigma[n] = var * (n + 1) / double(ngaussians);
+        n = binROHLengths(rohLength, binWidth, &x, &weight);
+        LOG.log("ROH length bins for GMM:", n);
     }
 
-    GMM gmm(ngaussians, W, Mu, Sigma, maxIter, tolerance, true);
-
-    gmm.estimate(rohLength->length, rohLength->size);
+    if (compareBIC) compareGMMComponents(x, weight, n, restarts, mu, var, W, Mu, Sigma, pool);
+    else fitGMM(x, weight, n, ngaussians, restarts, mu, var, W, Mu, Sigma, pool);
 
-    for (int n = 0; n < ngaussians; n++)
+    if (binWidth > 0)
     {
-        W[n] = gmm.getMixCoefficient(n);
-        Mu[n] = gmm.getMean(n);
-        Sigma[n] = gmm.getVar(n);
-        sortIndex[n] = n;
+        delete [] x;
+        delete [] weight;
     }
 
+    for (int k = 0; k < ngaussians; k++) sortIndex[k] = k;
+
     gsl_sort_index(sortIndex, Mu, 1, ngaussians);
 
     LOG.log("Gaussian class A ( mixture, mean, std ) = (", W[sortIndex[0]], false);
@@ -13,10 +13,24 @@
 #include "gsl/gsl_statistics.h"
 #include "gsl/gsl_sort.h"
 #include "BoundFinder.h"
+#include "garlic-threadpool.h"
+#include <algorithm>
 #include <limits>
 
 using namespace std;
 
+//Individuals and loci summed together by calcLODPrefix.  One block of
+//individuals is one packed genotype word.
+const int LOD_BLOCK_IND = 32;
+const int LOD_BLOCK_LOCI = 128;
+const int LOD_TASKS_PER_THREAD = 8;
+
+//EM settings for the size class GMM, and the largest number of
+//components compared by BIC
+const int GMM_MAX_ITER = 1000;
+const double GMM_TOLERANCE = 1e-5;
+const int GMM_BIC_MAX_COMPONENTS = 6;
+
 struct work_order_t
 {
   int id;
@@ -34,6 +48,28 @@ struct work_order_t
   string outfile;
 };
 
+//LOD score contributions of genotype codes 0, 1, 2 and missing at
+//each locus of one chromosome, lod[4 * locus + code].  Built once per
+//set of allele frequencies and error rate and shared by every window
+//size.
+struct LODTable
+{
+  double *lod;
+  int nloci;
+};
+
+//Running LOD score totals for one chromosome.  sum[ind][locus] is the
+//total over loci segStart[locus]..locus, where segStart[locus] is the
+//first locus after the last gap larger than MAX_GAP or touching the
+//centromere.  Any window size is then scored by subtraction.
+struct LODPrefix
+{
+  double **sum;
+  int *segStart;
+  int nind;
+  int nloci;
+};
+
 struct ROHData
 {
   string indID;
@@ -49,13 +85,27 @@ struct ROHLength
   int size;
 };
 
-void calcLOD(IndData *indData, MapData *mapData,
-             HapData *hapData, FreqData *freqData,
-             WinData *winData, centromere *centro,
-             int winsize, double error, int MAX_GAP);
+LODPrefix *initLODPrefix(MapData *mapData, centromere *centro, int nind, int MAX_GAP);
+void releaseLODPrefix(LODPrefix *lodPrefix);
+void releaseLODPrefix(vector< LODPrefix * > *lodPrefixByChr);
+
+LODPrefix *calcLODPrefix(MapData *mapData, HapData *hapData, LODTable *lodTable,
+                         centromere *centro, int MAX_GAP);
+vector< LODPrefix * > *calcLODPrefix(vector< HapData * > *hapDataByChr,
+                                     vector< LODTable * > *lodTableByChr,
+                                     vector< MapData * > *mapDataByChr,
+                                     centromere *centro, int MAX_GAP,
+                                     ThreadPool *pool);
+
+void calcLOD(LODPrefix *lodPrefix, WinData *winData, int winsize, LODHistogram *hist);
 
 double lod(const short &genotype, const double &freq, const double &error);
 
+LODTable *initLODTable(FreqData *freqData, double error);
+vector< LODTable * > *initLODTable(vector< FreqData * > *freqDataByChr, double error);
+void releaseLODTable(LODTable *lodTable);
+void releaseLODTable(vector< LODTable * > *lodTableByChr);
+
 KDEResult *automaticallyChooseWindowSize(vector< HapData * > *hapDataByChr, vector< FreqData * > *freqDataByChr,
     vector< MapData * > *mapDataByChr, IndData *indData,
     centromere *centro, int &winsize, double error, int MAX_GAP,
@@ -66,12 +116,12 @@ KDEWinsizeReport *calculateLODOverWinsizeRange(vector< HapData * > *hapDataByChr
     centromere *centro, vector<int> *multiWinsizes, double error, int MAX_GAP,
     int KDE_SUBSAMPLE, int numThreads, bool WINSIZE_EXPLORE, string outfile);
 
-vector< WinData * > *calcLODWindows(vector< HapData * > *hapDataByChr,
-                                    vector< FreqData * > *freqDataByChr,
+vector< WinData * > *calcLODWindows(vector< LODPrefix * > *lodPrefixByChr,
                                     vector< MapData * > *mapDataByChr,
                                     IndData *indData,
-                                    centromere *centro,
-                                    int winsize, double error, int MAX_GAP);
+                                    int winsize,
+                                    LODHistogram *hist, const bool *histInd,
+                                    ThreadPool *pool);
 
 vector< ROHData * > *assembleROHWindows(vector< WinData * > *winDataByChr,
                                         vector< MapData * > *mapDataByChr,
@@ -81,7 +131,46 @@ vector< ROHData * > *assembleROHWindows(vector< WinData * > *winDataByChr,
                                         ROHLength **rohLength,
                                         int winSize,
                                         int MAX_GAP,
-                                        double OVERLAP_FRAC);
+                                        double OVERLAP_FRAC,
+                                        ThreadPool *pool);
+
+//The same from single precision scores, one block of nind rows of
+//nloci floats per chromosome
+vector< ROHData * > *assembleROHScores(vector< float * > *scoresByChr,
+                                       vector< MapData * > *mapDataByChr,
+                                       IndData *indData,
+                                       centromere *centro,
+                                       double lodScoreCutoff,
+                                       ROHLength **rohLength,
+                                       int winSize,
+                                       int MAX_GAP,
+                                       double OVERLAP_FRAC,
+                                       ThreadPool *pool);
+
+//Streaming alternatives to calcLODWindows followed by
+//assembleROHWindows that never hold the window scores of the whole
+//sample, at the cost of scoring every window once per call.
+LODHistogram *scanLODHistogram(vector< HapData * > *hapDataByChr,
+                               vector< LODTable * > *lodTableByChr,
+                               vector< MapData * > *mapDataByChr,
+                               centromere *centro,
+                               int winsize,
+                               int MAX_GAP,
+                               const bool *histInd,
+                               ThreadPool *pool);
+
+vector< ROHData * > *scanROH(vector< HapData * > *hapDataByChr,
+                             vector< LODTable * > *lodTableByChr,
+                             vector< MapData * > *mapDataByChr,
+                             IndData *indData,
+                             centromere *centro,
+                             double lodScoreCutoff,
+                             ROHLength **rohLength,
+                             int winSize,
+                             int MAX_GAP,
+                             double OVERLAP_FRAC,
+                             vector< float * > *winOutByChr,
+                             ThreadPool *pool);
 
 ROHLength *initROHLength(int size, string pop);
 void releaseROHLength(ROHLength *rohLength);
@@ -98,30 +187,29 @@ void releaseROHData(vector< ROHData * > *rohDataByInd);
 string makeROHFilename(string outfile);
 
 double selectLODCutoff(KDEResult *kdeResult);
-double selectLODCutoff(vector< WinData * > *winDataByChr, IndData *indData, int KDE_SUBSAMPLE, string kdeoutfile);
+double selectLODCutoff(LODHistogram *hist, string kdeoutfile);
+bool *selectKDEIndividuals(IndData *indData, int KDE_SUBSAMPLE);
 
-void exploreWinsizes(vector< HapData * > *hapDataByChr,
-                     vector< FreqData * > *freqDataByChr,
+void exploreWinsizes(vector< LODPrefix * > *lodPrefixByChr,
                      vector< MapData * > *mapDataByChr,
                      IndData *indData,
-                     centromere *centro,
                      vector<int> &multiWinsizes,
-                     double error,
-                     int MAX_GAP, int KDE_SUBSAMPLE, string outfile);
+                     string outfile,
+                     ThreadPool *pool);
 
-KDEResult *selectWinsizeFromList(vector< HapData * > *hapDataByChr,
-                  vector< FreqData * > *freqDataByChr,
+KDEResult *selectWinsizeFromList(vector< LODPrefix * > *lodPrefixByChr,
                   vector< MapData * > *mapDataByChr,
-                  IndData *indData, centromere *centro,
-                  vector<int> *multiWinsizes, int &winsize, double error,
-                  int MAX_GAP, int KDE_SUBSAMPLE, string outfile);
+                  IndData *indData,
+                  vector<int> *multiWinsizes, int &winsize,
+                  string outfile,
+                  ThreadPool *pool);
 
-KDEResult *selectWinsize(vector< HapData * > *hapDataByChr,
-                  vector< FreqData * > *freqDataByChr,
+KDEResult *selectWinsize(vector< LODPrefix * > *lodPrefixByChr,
                   vector< MapData * > *mapDataByChr,
-                  IndData *indData, centromere *centro,
-                  int &winsize, int step, double error,
-                  int MAX_GAP, int KDE_SUBSAMPLE, string outfile);
+                  IndData *indData,
+                  int &winsize, int step, bool bracket,
+                  string outfile,
+                  ThreadPool *pool);
 
 //int selectWinsize(KDEWinsizeReport *winsizeReport, double AUTO_WINSIZE_THRESHOLD);
 
@@ -129,7 +217,11 @@ vector<int> *getWinsizeList(int lastWinsize, int stepSize, int numThreads);
 
 bool inGap(int qStart, int qEnd, int targetStart, int targetEnd);
 
-int_pair_t selectSizeClasses(ROHLength *rohLength);
+//With binWidth > 0 the GMM is fit to a weighted histogram of the lengths.
+//restarts adds k-means++ seeded EM runs, and compareBIC logs the BIC of
+//other numbers of components.
+int_pair_t selectSizeClasses(ROHLength *rohLength, int binWidth, int restarts, bool compareBIC,
+                             ThreadPool *pool);
 
 void compute(void *order);
 
@@ -0,0 +1,176 @@
+#include "garlic-threadpool.h"
+
+struct pool_worker_t
+{
+    ThreadPool *pool;
+    int id;
+};
+
+static bool popTask(pool_queue_t *queue, bool fromHead, pool_task_t &task)
+{
+    bool found = false;
+    pthread_mutex_lock(&(queue->mutex));
+    if (queue->head < queue->tail)
+    {
+        if (fromHead) task = queue->tasks[queue->head++];
+        else task = queue->tasks[--queue->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&(queue->mutex));
+    return found;
+}
+
+//Own queue first, then steal from the others in turn
+static bool nextTask(ThreadPool *pool, int id, pool_task_t &task)
+{
+    if (popTask(&(pool->queues[id]), true, task)) return true;
+    for (int i = 1; i < pool->numThreads; i++)
+    {
+        if (popTask(&(pool->queues[(id + i) % pool->numThreads]), false, task)) return true;
+    }
+    return false;
+}
+
+static void *poolWorker(void *arg)
+{
+    pool_worker_t *worker = (pool_worker_t *)arg;
+    ThreadPool *pool = worker->pool;
+    int id = worker->id;
+    delete worker;
+
+    long seen = 0;
+    while (true)
+    {
+        pthread_mutex_lock(&(pool->mutex));
+        while (!pool->stop && pool->batch == seen)
+        {
+            pthread_cond_wait(&(pool->start), &(pool->mutex));
+        }
+        if (pool->stop)
+        {
+            pthread_mutex_unlock(&(pool->mutex));
+            break;
+        }
+        seen = pool->batch;
+        pthread_mutex_unlock(&(pool->mutex));
+
+        pool_task_t task;
+        int done = 0;
+        while (nextTask(pool, id, task))
+        {
+            task.run(task.arg);
+            done++;
+        }
+
+        pthread_mutex_lock(&(pool->mutex));
+        pool->pending -= done;
+        if (pool->pending == 0) pthread_cond_signal(&(pool->finished));
+        pthread_mutex_unlock(&(pool->mutex));
+    }
+    return NULL;
+}
+
+ThreadPool *initThreadPool(int numThreads)
+{
+    ThreadPool *pool = new ThreadPool;
+    pool->numThreads = (numThreads > 1) ? numThreads : 0;
+    pool->batch = 0;
+    pool->pending = 0;
+    pool->stop = false;
+    pool->workers = NULL;
+    pool->queues = NULL;
+    if (pool->numThreads == 0) return pool;
+
+    pthread_mutex_init(&(pool->mutex), NULL);
+    pthread_cond_init(&(pool->start), NULL);
+    pthread_cond_init(&(pool->finished), NULL);
+
+    pool->queues = new pool_queue_t[pool->numThreads];
+    for (int i = 0; i < pool->numThreads; i++)
+    {
+        pool->queues[i].head = 0;
+        pool->queues[i].tail = 0;
+        pthread_mutex_init(&(pool->queues[i].mutex), NULL);
+    }
+
+    pool->workers = new pthread_t[pool->numThreads];
+    for (int i = 0; i < pool->numThreads; i++)
+    {
+        pool_worker_t *worker = new pool_worker_t;
+        worker->pool = pool;
+        worker->id = i;
+        pthread_create(&(pool->workers[i]), NULL, poolWorker, (void *)worker);
+    }
+    return pool;
+}
+
+void runThreadPool(ThreadPool *pool, vector< pool_task_t > &tasks)
+{
+    if (tasks.size() == 0) return;
+    if (pool->numThreads == 0)
+    {
+        for (unsigned int i = 0; i < tasks.size(); i++) tasks[i].run(tasks[i].arg);
+        return;
+    }
+
+    //pending is set before any task becomes visible, since a worker still
+    //leaving the previous batch may pick tasks up as soon as a queue
+    //is refilled
+    pthread_mutex_lock(&(pool->mutex));
+    pool->pending = tasks.size();
+    pthread_mutex_unlock(&(pool->mutex));
+
+    //Workers only look at a queue's tasks while head < tail, so the
+    //tasks can be replaced before the bounds are reset
+    for (int i = 0; i < pool->numThreads; i++)
+    {
+        pool->queues[i].tasks.clear();
+    }
+    for (unsigned int i = 0; i < tasks.size(); i++)
+    {
+        pool->queues[i % pool->numThreads].tasks.push_back(tasks[i]);
+    }
+    for (int i = 0; i < pool->numThreads; i++)
+    {
+        pthread_mutex_lock(&(pool->queues[i].mutex));
+        pool->queues[i].head = 0;
+        pool->queues[i].tail = pool->queues[i].tasks.size();
+        pthread_mutex_unlock(&(pool->queues[i].mutex));
+    }
+
+    pthread_mutex_lock(&(pool->mutex));
+    pool->batch++;
+    pthread_cond_broadcast(&(pool->start));
+    while (pool->pending > 0)
+    {
+        pthread_cond_wait(&(pool->finished), &(pool->mutex));
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+    return;
+}
+
+void releaseThreadPool(ThreadPool *pool)
+{
+    if (pool == NULL) return;
+    if (pool->numThreads > 0)
+    {
+        pthread_mutex_lock(&(pool->mutex));
+        pool->stop = true;
+        pthread_cond_broadcast(&(pool->start));
+        pthread_mutex_unlock(&(pool->mutex));
+
+        for (int i = 0; i < pool->numThreads; i++)
+        {
+            pthread_join(pool->workers[i], NULL);
+            pthread_mutex_destroy(&(pool->queues[i].mutex));
+        }
+        pthread_mutex_destroy(&(pool->mutex));
+        pthread_cond_destroy(&(pool->start));
+        pthread_cond_destroy(&(pool->finished));
+
+        delete [] pool->workers;
+        delete [] pool->queues;
+    }
+    delete pool;
+    return;
+}
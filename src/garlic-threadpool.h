@@ -0,0 +1,52 @@
+#ifndef __GARLIC_THREADPOOL_H__
+#define __GARLIC_THREADPOOL_H__
+
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+struct pool_task_t
+{
+    void (*run)(void *);
+    void *arg;
+};
+
+//The tasks dealt to one worker.  The owner takes tasks from the head,
+//idle workers steal from the tail.
+struct pool_queue_t
+{
+    vector< pool_task_t > tasks;
+    int head;
+    int tail;
+    pthread_mutex_t mutex;
+};
+
+struct ThreadPool
+{
+    int numThreads;
+    pthread_t *workers;
+    pool_queue_t *queues;
+
+    //Incremented each time a batch of tasks is handed out
+    long batch;
+    int pending;
+    bool stop;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+};
+
+//With numThreads <= 1 no workers are started and tasks run on the
+//calling thread.
+ThreadPool *initThreadPool(int numThreads);
+
+//Runs every task and returns once all have finished.  Tasks should be
+//given largest first; they are dealt round robin to the workers, which
+//steal from each other when their own queue runs dry.
+void runThreadPool(ThreadPool *pool, vector< pool_task_t > &tasks);
+
+void releaseThreadPool(ThreadPool *pool);
+
+#endif
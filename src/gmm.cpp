@@ -37,6 +37,14 @@
 
     To run the EM algorithm, call GMM::estimate(double *data, int dataSize)
 
+    To fit data given as distinct values with counts (e.g. a histogram), call
+    GMM::estimate(double *data, double *weight, int dataSize).  Each value then counts
+    weight times, and the cost of an iteration depends only on dataSize.
+
+    The E step can be spread over a ThreadPool with GMM::setThreadPool(ThreadPool *pool).
+    The data are cut into fixed chunks whatever the number of threads, so results do
+    not depend on it.
+
     Example:
 
       GMM gmm(n,a,mean,var);
@@ -71,6 +79,17 @@
 
 using namespace std;
 
+//One chunk of the data for GMM::update.  stats holds sum_wj, sum_wj_xj
+//and sum_wj_xj2 for each component, in that order.
+struct gmm_chunk_t
+{
+    GMM *gmm;
+    int first;
+    int last;
+    double *stats;
+    double L;
+};
+
 
 double GMM::getMixCoefficient(int i)
 {
@@ -177,10 +196,11 @@ GMM::GMM(int n, double *a_init, double *mean_init, double *var_init, int maxIt =
     mean = new double [numGaussians];
     var = new double [numGaussians];
 
-    resp = new double[numGaussians];
     sum_wj = new double[numGaussians];
     sum_wj_xj = new double[numGaussians];
     sum_wj_xj2 = new double[numGaussians];
+    logNorm = new double[numGaussians];
+    halfPrec = new double[numGaussians];
 
     for (int i = 0; i < numGaussians; i++)
     {
@@ -190,9 +210,11 @@ GMM::GMM(int n, double *a_init, double *mean_init, double *var_init, int maxIt =
     }
 
     x = NULL;
+    wt = NULL;
     maxIterations = maxIt;
     precision = p;
     verbose = v;
+    pool = NULL;
 
     loglikelihood = -numeric_limits<double>::max();
     BIC = numeric_limits<double>::max();
@@ -203,20 +225,118 @@ GMM::GMM(int n, double *a_init, double *mean_init, double *var_init, int maxIt =
 GMM::~GMM()
 {
     x = NULL;
+    wt = NULL;
     delete [] a;
     delete [] mean;
     delete [] var;
-    delete [] resp;
     delete [] sum_wj;
     delete [] sum_wj_xj;
     delete [] sum_wj_xj2;
+    delete [] logNorm;
+    delete [] halfPrec;
     return;
 }
 
-double GMM::normalLog(double x, double mean, double var)
+void GMM::setThreadPool(ThreadPool *p)
 {
-    const static double C = (-0.5 * gsl_sf_log(2 * M_PI));
-    return C - (0.5 * gsl_sf_log(var)) - gsl_pow_2(x - mean) / (2.0 * var);
+    pool = p;
+    return;
+}
+
+/*
+  E step over the data points x[first..last), BLOCK_SIZE points at a time.
+  Inside a block the loops run over the points with the component fixed, so
+  the log densities, the log-sum-exp and the sums vectorize.  Responsibilities
+  are exp(l_jk - l_max) / \sum_i exp(l_ji - l_max), the same quantity as
+  w_{jk} below computed with one exp per component.
+
+  With weights, every term of a point is multiplied by its weight.
+
+  Returns the log likelihood of the chunk and adds its sufficient statistics
+  to stats.
+ */
+double GMM::accumulate(int first, int last, double *stats)
+{
+    double *r = new double[numGaussians * BLOCK_SIZE];
+    double l_max[BLOCK_SIZE];
+    double tot[BLOCK_SIZE];
+    double L = 0;
+
+    for (int start = first; start < last; start += BLOCK_SIZE)
+    {
+        int n = (last - start < BLOCK_SIZE) ? last - start : BLOCK_SIZE;
+        const double *xb = x + start;
+
+        for (int j = 0; j < n; j++) l_max[j] = -numeric_limits<double>::max();
+        for (int k = 0; k < numGaussians; k++)
+        {
+            double *rk = r + k * BLOCK_SIZE;
+            double mu = mean[k];
+            double c = logNorm[k];
+            double h = halfPrec[k];
+            for (int j = 0; j < n; j++)
+            {
+                double d = xb[j] - mu;
+                rk[j] = c - d * d * h;
+                l_max[j] = (rk[j] > l_max[j]) ? rk[j] : l_max[j];
+            }
+        }
+
+        //logsum to avoid at least 1 underflow
+        for (int j = 0; j < n; j++) tot[j] = 0;
+        for (int k = 0; k < numGaussians; k++)
+        {
+            double *rk = r + k * BLOCK_SIZE;
+            for (int j = 0; j < n; j++)
+            {
+                rk[j] = exp(rk[j] - l_max[j]);
+                tot[j] += rk[j];
+            }
+        }
+        if (wt == NULL)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                L += l_max[j] + log(tot[j]);
+                tot[j] = 1.0 / tot[j];
+            }
+        }
+        else
+        {
+            const double *wb = wt + start;
+            for (int j = 0; j < n; j++)
+            {
+                L += wb[j] * (l_max[j] + log(tot[j]));
+                tot[j] = wb[j] / tot[j];
+            }
+        }
+
+        for (int k = 0; k < numGaussians; k++)
+        {
+            double *rk = r + k * BLOCK_SIZE;
+            double s0 = 0, s1 = 0, s2 = 0;
+            for (int j = 0; j < n; j++)
+            {
+                double w = rk[j] * tot[j];
+                s0 += w;
+                s1 += w * xb[j];
+                s2 += w * xb[j] * xb[j];
+            }
+            stats[k] += s0;
+            stats[numGaussians + k] += s1;
+            stats[2 * numGaussians + k] += s2;
+        }
+    }
+
+    delete [] r;
+    return L;
+}
+
+void GMM::runChunk(void *arg)
+{
+    gmm_chunk_t *chunk = (gmm_chunk_t *)arg;
+    chunk->L = chunk->gmm->accumulate(chunk->first, chunk->last, chunk->stats);
+    return;
 }
 
 
@@ -238,6 +358,9 @@ double GMM::normalLog(double x, double mean, double var)
     broken down in such a way as to minimize the number of loops needed (or at least get close
     to the minimum).  I could be very wrong.
 
+    The E step is done by accumulate() over fixed chunks of the data, on the thread pool
+    if one is set, and the chunk sums are then added up in order.
+
     Parameters a, mean, var, a_t, mean_t, var_t, BIC, and loglikelohood are modified.
 
     E-step:
@@ -258,7 +381,7 @@ double GMM::normalLog(double x, double mean, double var)
       k : indexes Gaussian components
       K : total number of Gaussians
       j : indexes data
-      N : total number of data points
+      N : total number of data points (total weight for weighted data)
       x_j : jth element of the data array x
       w_{jk} : prob of membership of data point j in gaussian k
       a_k : mixture coefficient for Gaussian k
@@ -271,58 +394,66 @@ double GMM::normalLog(double x, double mean, double var)
  */
 void GMM::update()
 {
-    double den;
-    double l_max, tmp, sum;
+    const static double C = (-0.5 * gsl_sf_log(2 * M_PI));
 
     for (int k = 0; k < numGaussians; k++)
     {
         sum_wj[k] = 0;
         sum_wj_xj[k] = 0;
         sum_wj_xj2[k] = 0;
-    }
 
-    double L = 0;
+        //Constant over the data, so taken out of the E step.  A collapsed
+        //component gives -inf or NaN here rather than a GSL domain error.
+        logNorm[k] = log(a[k]) + C - 0.5 * log(var[k]);
+        halfPrec[k] = 1.0 / (2.0 * var[k]);
+    }
 
-    for (int j = 0; j < dataSize; j++)
+    int nchunks = (dataSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    gmm_chunk_t *chunks = new gmm_chunk_t[nchunks];
+    double *stats = new double[3 * numGaussians * nchunks];
+    vector< pool_task_t > tasks;
+    for (int c = 0; c < nchunks; c++)
     {
-        l_max = -numeric_limits<double>::max();
-        for (int i = 0; i < numGaussians; i++)
-        {
-            resp[i] = gsl_sf_log(a[i]) + normalLog(x[j], mean[i], var[i]); //calculating log(p_i(x_j|theta_i)
-            if (resp[i] > l_max) l_max = resp[i];
-        }
-
-        //logsum to avoid at least 1 underflow
-        sum = 0;
-        for (int i = 0; i < numGaussians; i++) sum += exp(resp[i] - l_max);
-        tmp = l_max + gsl_sf_log(sum);
-
-        L += tmp;//loglikelihood
+        chunks[c].gmm = this;
+        chunks[c].first = c * CHUNK_SIZE;
+        chunks[c].last = (dataSize - chunks[c].first < CHUNK_SIZE) ? dataSize : chunks[c].first + CHUNK_SIZE;
+        chunks[c].stats = stats + 3 * numGaussians * c;
+        for (int k = 0; k < 3 * numGaussians; k++) chunks[c].stats[k] = 0;
+
+        pool_task_t task;
+        task.run = runChunk;
+        task.arg = (void *)(&chunks[c]);
+        tasks.push_back(task);
+    }
 
-        den = 0;
-        for (int i = 0; i < numGaussians; i++)
-        {
-            resp[i] = exp(resp[i] - tmp);
-            den += resp[i];
-        }
+    if (pool != NULL) runThreadPool(pool, tasks);
+    else for (int c = 0; c < nchunks; c++) runChunk((void *)(&chunks[c]));
 
+    //Chunks are reduced in order
+    double L = 0;
+    for (int c = 0; c < nchunks; c++)
+    {
+        L += chunks[c].L;//loglikelihood
         for (int k = 0; k < numGaussians; k++)
         {
-            sum_wj[k] += resp[k] / den;
-            sum_wj_xj[k] += x[j] * resp[k] / den;
-            sum_wj_xj2[k] += x[j] * x[j] * resp[k] / den;
+            sum_wj[k] += chunks[c].stats[k];
+            sum_wj_xj[k] += chunks[c].stats[numGaussians + k];
+            sum_wj_xj2[k] += chunks[c].stats[2 * numGaussians + k];
         }
     }
+    delete [] chunks;
+    delete [] stats;
+
     //Assign next iteration parameters to current parameters
     for (int k = 0; k < numGaussians; k++)
     {
-        a[k] = sum_wj[k] / double(dataSize);
+        a[k] = sum_wj[k] / totalWeight;
         mean[k] = sum_wj_xj[k] / sum_wj[k];
         var[k] = sum_wj_xj2[k] / sum_wj[k] - mean[k] * mean[k];
     }
 
     loglikelihood = L;
-    BIC = -2.0 * loglikelihood + double(3.0 * numGaussians - 1) * gsl_sf_log(dataSize);
+    BIC = -2.0 * loglikelihood + double(3.0 * numGaussians - 1) * gsl_sf_log(totalWeight);
     return;
 }
 
@@ -370,6 +501,15 @@ void GMM::printState()
 
  */
 bool GMM::estimate(double *data, int size)
+{
+    return estimate(data, NULL, size);
+}
+
+/*
+  As above, with data[j] counted weight[j] times.  A NULL weight counts every point
+  once.
+ */
+bool GMM::estimate(double *data, double *weight, int size)
 {
     bool converged = false;
 
@@ -379,6 +519,19 @@ bool GMM::estimate(double *data, int size)
         throw 1;
     }
 
+    totalWeight = size;
+    if (weight != NULL)
+    {
+        totalWeight = 0;
+        for (int j = 0; j < size; j++) totalWeight += weight[j];
+        if (totalWeight <= 0)
+        {
+            cerr << "Invalid weights.\n";
+            throw 1;
+        }
+    }
+    wt = weight;
+
     if (verbose) cerr << "Begin GMM estimation with k = " << numGaussians << " Gaussians...\n";
 
     dataSize = size;
@@ -37,6 +37,14 @@
 
     To run the EM algorithm, call GMM::estimate(double *data, int dataSize)
 
+    To fit data given as distinct values with counts (e.g. a histogram), call
+    GMM::estimate(double *data, double *weight, int dataSize).  Each value then counts
+    weight times, and the cost of an iteration depends only on dataSize.
+
+    The E step can be spread over a ThreadPool with GMM::setThreadPool(ThreadPool *pool).
+    The data are cut into fixed chunks whatever the number of threads, so results do
+    not depend on it.
+
     Example:
 
       GMM gmm(n,a,mean,var);
@@ -60,24 +68,35 @@
 
  */
 
+#include "garlic-threadpool.h"
 
 class GMM
 {
 private:
 
+    //Data points per task, and per block of the vectorized inner loops
+    static const int CHUNK_SIZE = 65536;
+    static const int BLOCK_SIZE = 256;
+
     int numGaussians; //How many gaussians do we assume?
     double *a; //Mixture proportions
     double *mean;
     double *var;
 
     //for holding intermediate results
-    double *resp;
     double *sum_wj;
     double *sum_wj_xj;
     double *sum_wj_xj2;
 
+    //Per component constants of the current iteration,
+    //log(a_k) - log(2 pi var_k) / 2 and 1 / (2 var_k)
+    double *logNorm;
+    double *halfPrec;
+
     int dataSize;
     double *x; //a pointer to the data of length dataSize
+    double *wt; //weights of the data, NULL if every point counts once
+    double totalWeight; //sum of wt, or dataSize
 
     int maxIterations; //EM will stop after this many iterations if it hasn't converged
     double precision; //Convergence condition
@@ -87,17 +106,24 @@ private:
     double loglikelihood; //of the data given the given model and current parameters
     double BIC; //Bayseian Information Criteria for the data given the given model and current parameters
 
+    ThreadPool *pool; //NULL to run on the calling thread
+
     void update(); //Update parameters, this folds the E step, M step, loglikelihood, and BIC calculation into a single calculation
     void printState();
 
-    double normalLog(double x, double mean, double var);
+    //E step sufficient statistics and log likelihood for x[first..last)
+    double accumulate(int first, int last, double *stats);
+    static void runChunk(void *arg);
 
 public:
 
     GMM(int n, double *a_init, double *mean_init, double *var_init, int maxIt, double p, bool v = true);
     ~GMM();
 
+    void setThreadPool(ThreadPool *p);
+
     bool estimate(double *data, int size);
+    bool estimate(double *data, double *weight, int size);
 
     double getBIC();
     double getLogLikelihood();
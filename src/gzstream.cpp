@@ -27,8 +27,10 @@
 // ============================================================================
 
 #include "gzstream.h"
+#include "garlic-errlog.h"
 #include <iostream>
 #include <string.h>  // for memcpy
+#include <stdio.h>   // for fileno
 
 #ifdef GZSTREAM_NAMESPACE
 namespace GZSTREAM_NAMESPACE {
@@ -58,7 +60,20 @@ gzstreambuf* gzstreambuf::open( const char* name, int open_mode) {
         *fmodeptr++ = 'w';
     *fmodeptr++ = 'b';
     *fmodeptr = '\0';
-    file = gzopen( name, fmode);
+    // BGZF input is inflated block-parallel when more than one thread
+    // is available; plain gzip and uncompressed files take the zlib path
+    if ( (mode & std::ios::in) && getBGZFThreads() > 1 && isBGZF( name)) {
+        bgzf = openBGZF( name, getBGZFThreads());
+        if (bgzf == 0)
+            return (gzstreambuf*)0;
+        opened = 1;
+        return this;
+    }
+    // "-" reads from stdin or writes to stdout
+    if ( strcmp( name, "-") == 0)
+        file = gzdopen( fileno( (mode & std::ios::in) ? stdin : stdout), fmode);
+    else
+        file = gzopen( name, fmode);
     if (file == 0)
         return (gzstreambuf*)0;
     opened = 1;
@@ -67,8 +82,14 @@ gzstreambuf* gzstreambuf::open( const char* name, int open_mode) {
 
 gzstreambuf * gzstreambuf::close() {
     if ( is_open()) {
-        sync();
         opened = 0;
+        if ( bgzf) {
+            closeBGZF( bgzf);
+            bgzf = 0;
+            setg( buffer + 4, buffer + 4, buffer + 4);
+            return this;
+        }
+        sync();
         if ( gzclose( file) == Z_OK)
             return this;
     }
@@ -81,6 +102,17 @@ int gzstreambuf::underflow() { // used for input buffer only
 
     if ( ! (mode & std::ios::in) || ! opened)
         return EOF;
+    if ( bgzf) {
+        // hand out the decompressed block in place, no putback area
+        char* data;
+        int num = readBGZFBlock( bgzf, &data);
+        if (num < 0)
+            throw 0;
+        if (num == 0)
+            return EOF;
+        setg( data, data, data + num);
+        return * reinterpret_cast<unsigned char *>( gptr());
+    }
     // Josuttis' implementation of inbuf
     int n_putback = gptr() - eback();
     if ( n_putback > 4)
@@ -88,8 +120,16 @@ int gzstreambuf::underflow() { // used for input buffer only
     memcpy( buffer + (4 - n_putback), gptr() - n_putback, n_putback);
 
     int num = gzread( file, buffer+4, bufferSize-4);
-    if (num <= 0) // ERROR or EOF
+    if (num <= 0) { // ERROR or EOF
+        // a truncated gzip member reads as 0 bytes with Z_BUF_ERROR
+        int err;
+        const char* msg = gzerror( file, &err);
+        if (num < 0 || err != Z_OK) {
+            LOG.err("ERROR: Failed to decompress input:", std::string(msg));
+            throw 0;
+        }
         return EOF;
+    }
 
     // reset buffer pointers
     setg( buffer + (4 - n_putback),   // beginning of putback area
@@ -152,6 +192,7 @@ void gzstreambase::open( const char* name, int open_mode) {
 }
 
 void gzstreambase::close() {
+    exceptions( std::ios::goodbit);
     if ( buf.is_open())
         if ( ! buf.close())
             clear( rdstate() | std::ios::badbit);